@@ -15,6 +15,14 @@
 #include <cerrno>
 #include <vector>
 #include <termios.h> // to handle raw input from the terminal
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <time.h>
+#include <sys/resource.h>
+#include <bitset>
+#include <map>
+#include <cstdint>
 
 // COLORS for terminal output
 #define GREEN "\033[1;32m"
@@ -30,33 +38,366 @@ enum JobStatus
     STOPPED // For later when we add Ctrl+Z
 };
 
+// CPU affinity, priorities and resource limits of a job (placement.cpp)
+struct JobPlacement
+{
+    std::string cpus;     // affinity list as given ("0-3,8"), empty: inherited
+    bool set_nice = false;
+    int nice = 0;
+    int io_class = -1;    // I/O priority class (1 realtime, 2 best-effort, 3 idle), -1: inherited
+    int io_level = 4;     // 0-7 within the class
+    std::map<int, rlim_t> limits; // RLIMIT_AS / RLIMIT_NOFILE / RLIMIT_CPU -> value
+    bool hard_limits = false;     // -H: the limits set the hard limit too
+
+    bool empty() const { return cpus.empty() && !set_nice && io_class < 0 && limits.empty(); }
+};
+
 struct Job
 {
     int jid;
-    pid_t pid;
+    pid_t pid;  // pid we wait on (last stage of a pipeline)
+    pid_t pgid; // process group that fg/bg signal
     std::string command;
     JobStatus status;
+    std::vector<pid_t> pids; // every member process, in pipeline order
+    int live = 0;            // members not reaped yet
+    int exit_status = 0;     // exit code of 'pid' once it has finished
+    struct timespec start_time; // CLOCK_MONOTONIC
+    JobPlacement placement;     // what job/bg options set on it
+};
+
+// Jobs indexed by jid, pid and pgid. A Job stays at the same address for
+// as long as it is in the table, and freed jids are handed out again
+// (lowest first), so lookups and updates are O(1) however many jobs run.
+struct JobTable
+{
+    Job &add(pid_t pgid, const std::vector<pid_t> &pids, const std::string &command, JobStatus status);
+    void remove(int jid);
+    Job *find(int jid);
+    Job *find_by_pid(pid_t pid);
+    Job *find_by_pgid(pid_t pgid);
+    Job *record_status(pid_t pid, int status); // apply one waitpid() result
+    std::vector<Job *> list();                 // in jid order
+    size_t size() const { return count; }
+
+private:
+    std::deque<Job> slots; // slot jid - 1; a deque never moves its elements
+    std::vector<bool> used;
+    std::priority_queue<int, std::vector<int>, std::greater<int>> free_jids;
+    std::unordered_map<pid_t, int> by_pid; // live member pid -> jid
+    std::unordered_map<pid_t, int> by_pgid;
+    size_t count = 0;
+};
+
+// How child processes are started (SHELL_LAUNCH=fork selects the fork path)
+enum LaunchBackend
+{
+    LAUNCH_SPAWN, // posix_spawn, falls back to fork only where it has to
+    LAUNCH_FORK
+};
+
+// Where a launched command's process group and stdio should go
+struct LaunchSpec
+{
+    pid_t pgid = -1;          // -1: stay in the shell's group, 0: new group, >0: join group
+    bool foreground = false;  // hand the terminal to the child's group
+    bool null_stdin = false;  // background jobs read from /dev/null...
+    bool null_stdout = false; // ...and write stdout/stderr to /dev/null
+    int stdin_fd = -1;        // pipe ends to install as stdin/stdout
+    int stdout_fd = -1;
+    char **envp = NULL;       // NULL: the exported variables (var_envp)
+    const struct Node *subshell = NULL; // compound command to run in a forked child instead
+    const struct JobPlacement *placement = NULL; // "job" options, applied by the child before exec
+};
+
+// A shell variable; exported ones go into every command's environment
+struct ShellVar
+{
+    std::string value;
+    bool exported = false;
+};
+
+// NAME=value prefixes of a command, already expanded
+typedef std::vector<std::pair<std::string, std::string>> Assignments;
+
+// A variable as it was before a temporary assignment
+struct SavedVar
+{
+    std::string name;
+    bool was_set;
+    ShellVar var;
+};
+
+// Where a fork-free builtin reads and writes. In the shell these are the
+// standard fds; on a pipeline thread they are the stage's pipe ends.
+struct BuiltinIO
+{
+    int in = STDIN_FILENO;
+    int out = STDOUT_FILENO;
+    int err = STDERR_FILENO;
+    bool in_thread = false; // running on a pipeline thread: no side effects on the shell
+};
+
+// Command tree built by parse_command_line()
+enum NodeType
+{
+    NODE_LIST,     // and-or lists separated by ';', '&' or newlines
+    NODE_AND_OR,   // pipelines joined by '&&' / '||'
+    NODE_PIPELINE, // commands joined by '|'
+    NODE_COMMAND,  // words and redirections
+    NODE_IF,       // children: condition, body, ... [, else body]
+    NODE_WHILE,    // children: condition, body
+    NODE_UNTIL,
+    NODE_FOR,      // words: the items; children: body
+    NODE_CASE,     // words: the subject; children: item lists, their patterns in words
+    NODE_GROUP,    // { list; }
+    NODE_FUNCTION  // name() body: children: the body
+};
+
+// How a pipeline prefixed with the time keyword reports
+enum TimeFormat
+{
+    TIME_NONE,    // not timed
+    TIME_DEFAULT, // table: one row per stage and a total
+    TIME_POSIX,   // time -p: real/user/sys only
+    TIME_JSON     // time --json: one JSON object
+};
+
+enum RedirectType
+{
+    REDIR_IN,        // <
+    REDIR_OUT,       // >
+    REDIR_APPEND,    // >>
+    REDIR_HEREDOC,   // << and <<- (body in Redirect::heredoc)
+    REDIR_HERESTRING // <<<
+};
+
+struct Redirect
+{
+    int fd;             // fd being redirected (0 for '<', 1 for '>' unless "2>")
+    RedirectType type;
+    std::string target; // raw file name word (delimiter for <<, the word for <<<)
+    std::string heredoc;        // here-document body, leading tabs already removed for <<-
+    bool expand_heredoc = true; // false if the delimiter was quoted
+};
+
+struct Node
+{
+    NodeType type = NODE_LIST;
+    std::vector<Node> children;       // LIST / AND_OR / PIPELINE members, compound command parts
+    std::vector<std::string> assigns; // COMMAND: NAME=value words in front of the command
+    std::vector<std::string> words;   // COMMAND: raw words, quotes kept for expansion
+    std::vector<Redirect> redirects;  // COMMAND and compound commands
+    std::vector<bool> or_ops;         // AND_OR: operator before children[i + 1] ('||' if true)
+    bool background = false;          // AND_OR: terminated by '&'
+    TimeFormat time_format = TIME_NONE; // PIPELINE: prefixed with 'time'
+    bool negate = false;              // PIPELINE: prefixed with '!'
+    std::vector<std::string> job_options; // PIPELINE: raw option words of a 'job' prefix
+    std::string name;                 // FOR: the variable, FUNCTION: the function name
+    std::string text;                 // source text, used as the job name
+};
+
+// What one pipeline stage cost, for the time keyword
+struct StageUsage
+{
+    std::string command;
+    pid_t pid = -1;          // -1: ran inside the shell (builtin or thread)
+    int status = 0;          // exit code
+    double real = 0;         // seconds from pipeline start until it finished
+    struct rusage usage = {};
+};
+
+// What the line editor last drew after the prompt
+struct LineView
+{
+    std::string shown; // buffer contents currently on screen
+    int cursor = 0;    // cursor column, relative to the end of the prompt
+};
+
+// Owning argv: every argument lives in one arena (each followed by '\0')
+// and ptrs is the NULL-terminated array that exec wants. Building one costs
+// two allocations no matter how many arguments there are.
+struct Argv
+{
+    std::string arena;
+    std::vector<char *> ptrs;
+
+    Argv() = default;
+    Argv(const Argv &) = delete; // ptrs point into arena
+    Argv &operator=(const Argv &) = delete;
+    Argv(Argv &&other) noexcept { *this = std::move(other); }
+    Argv &operator=(Argv &&other) noexcept
+    {
+        const char *old_base = other.arena.data();
+        arena = std::move(other.arena);
+        ptrs = std::move(other.ptrs);
+        // A short arena lives inside the string object and gets copied, so re-point
+        for (char *&p : ptrs)
+        {
+            if (p != NULL)
+                p = &arena[0] + (p - old_base);
+        }
+        return *this;
+    }
+
+    void finish(); // builds ptrs once all arguments are in the arena
+    char **data() { return ptrs.data(); }
+    char *operator[](size_t i) const { return ptrs[i]; }
+    size_t size() const { return ptrs.empty() ? 0 : ptrs.size() - 1; }
+};
+
+enum ParseStatus
+{
+    PARSE_OK,
+    PARSE_INCOMPLETE, // open quote or trailing '|', '&&', '||': needs another line
+    PARSE_ERROR
+};
+
+// What an incomplete parse is waiting for, so whoever feeds it lines can
+// hold off parsing again until a line arrives that could finish it
+struct ParseWait
+{
+    bool heredoc = false;   // a line holding only delimiter...
+    std::string delimiter;
+    bool strip_tabs = false; // ...once leading tabs are stripped (<<-)
+    char quote = 0;          // a line with this quote in it
+    std::vector<std::string> closers;   // fi/done/esac/} of the compound commands still open
+    std::map<std::string, int> balance; // closers minus openers in the lines since
+};
+
+// One compiled glob component (no '/'): *, ?, [...] and backslash escapes
+struct GlobPattern
+{
+    bool has_wildcards = false;
+    std::string literal;        // the unescaped text, when there are no wildcards
+    std::string prefix, suffix; // literal text every match starts / ends with
+    size_t min_length = 0;      // characters a match has besides what stars take
+    bool any_length = false;    // there is a star
+    bool dot_ok = false;        // starts with a literal '.', so hidden names can match
+    std::vector<std::bitset<256>> sets; // characters each position accepts
+    std::vector<bool> star;             // the position is a '*'
+    std::vector<uint64_t> masks;        // per byte, the positions accepting it (under 64 positions)
+    uint64_t star_mask = 0;
+
+    bool compile(const std::string &pattern); // false if there are no wildcards
+    bool match(const char *name, size_t len) const;
+};
+
+// A redirection whose file was opened by the parent
+struct Redirection
+{
+    int fd = -1;     // opened file (O_CLOEXEC)
+    int target = -1; // fd it replaces in the child
 };
 
 // variables
-extern std::vector<Job> jobs_list;
+extern JobTable jobs_table;
+extern LaunchBackend launch_backend;
+extern bool interactive_mode; // false for -c, script files and piped stdin
+extern int last_status;       // exit status of the last command line
+extern int builtin_status;    // exit status of the last builtin run
+extern bool trace_enabled;    // set -o trace / $SIMPLE_SHELL_TRACE
+extern std::vector<std::string> positional_args; // $1, $2... of the script or the running function
+extern pid_t last_background_pid; // $!
 static std::string old_pwd = "";
 
 // prototypes
-bool handle_builtin(std::vector<char *> &args);
-int get_next_jid();
+bool handle_builtin(char **args);
 std::string trim(const std::string &s);
-std::vector<std::string> split_commands(std::string input);
-std::vector<std::string> split_pipes(const std::string &input);
-std::vector<char *> tokenize_input(const std::string &input);
-std::vector<std::string> split_by_ampersand(const std::string &input);
+ParseStatus parse_command_line(const std::string &input, Node &tree, std::string &error,
+                               ParseWait *wait = nullptr);
+bool line_may_finish(ParseWait &wait, const std::string &line);
+bool expand_word(const std::string &raw, std::string &out);
+bool expand_word_into(const std::string &raw, std::string &out, bool split = false,
+                      std::vector<size_t> *globs = nullptr);
+bool glob_expand(const std::string &pattern, std::vector<std::string> &matches);
+bool command_substitution(const std::string &commands, std::string &out);
+size_t find_substitution_end(const std::string &s, size_t open);
+size_t find_backquote_end(const std::string &s, size_t open);
+void expand_heredoc(const std::string &body, std::string &out);
+Argv build_argv(const Node &cmd);
+Assignments build_assignments(const Node &cmd);
 void enable_raw_mode();
-void handle_tab_completion(std::string& cmd_buffer, int& cursor_pos);  
+std::string find_longest_common_prefix(std::vector<std::string> &matches);
+bool handle_tab_completion(std::string& cmd_buffer, int& cursor_pos);
 void disable_raw_mode(); 
+void render_line_diff(LineView &view, const std::string &buffer, int cursor_pos, std::string &out);
+void refresh_line(LineView &view, const std::string &buffer, int cursor_pos);
+bool write_all(int fd, const char *data, size_t len);
+bool input_pending();
+bool read_input_byte(char &c);
+void read_bracketed_paste(std::string &out);
 void handle_fg(int jid);
-void handle_bg(int jid);
-void execute_pipes(const std::string &input, bool is_background);
-bool handle_builtin(std::vector<char *> &args);
-void handle_redirection(std::string &cmd);
+void handle_bg(int jid, const JobPlacement &placement);
+int execute_list(const Node &list);
+int execute_and_or(const Node &and_or);
+int execute_pipeline(const Node &pipeline, bool is_background);
+int execute_compound(const Node &cmd);
+bool is_function(const char *name);
+int call_function(char **args);
+int wait_status_to_exit_code(int status);
+int run_command_line(const std::string &input);
+int run_batch(int fd);
+bool is_builtin(const char *name);
+void get_builtin_names(std::vector<std::string> &names);
+void run_parallel(char **args);
+bool is_fork_free_builtin(const char *name);
+int run_fork_free_builtin(char **args, const BuiltinIO &io);
+void start_command_index();
+void refresh_command_index();
+void get_command_completions(const std::string &prefix, std::vector<std::string> &matches);
+bool open_redirections(const std::vector<Redirect> &redirects, std::vector<Redirection> &opened);
+void close_redirections(std::vector<Redirection> &opened);
+pid_t launch_command(Argv &args, const std::vector<Redirect> &redirects, const LaunchSpec &spec,
+                     int &fail_status);
+bool resolve_command(const std::string &name, std::string &path);
+void clear_command_hash();
+void print_command_hash();
+void history_init();
+void history_add(const std::string &line);
+size_t history_size();
+const std::string &history_at(size_t index);
+void init_child_events();
+void reap_children();
+void record_child_status(pid_t pid, int status);
+bool finished_job_status(pid_t pid, int &code);
+bool finished_jid_status(int jid, int &code);
+int wait_builtin(char **args);
+bool is_valid_name(const std::string &name);
+const std::string *var_get(const std::string &name);
+void var_set(const std::string &name, const std::string &value, bool exported = false);
+bool var_export(const std::string &name);
+void var_unset(const std::string &name);
+std::vector<std::pair<std::string, std::string>> var_exported();
+char **var_envp();
+char **var_envp_with(const Assignments &assigns, std::vector<std::string> &storage, std::vector<char *> &ptrs);
+void var_apply_temporary(const Assignments &assigns, std::vector<SavedVar> &saved);
+void var_restore(const std::vector<SavedVar> &saved);
+void handle_child_events();
+bool wait_child_event(int timeout_ms);
+void print_job_notifications();
+bool wait_for_input(int fd);
+void print_prompt(bool refresh);
+void prompt_attach_line(LineView *view, const std::string *buffer, const int *cursor);
+void prompt_command_finished(double seconds);
+int prompt_update_fd();
+void handle_prompt_update();
+bool parse_placement(char **args, size_t &i, JobPlacement &out, const char *who);
+bool placement_option_has_value(const std::string &option);
+void merge_placement(JobPlacement &into, const JobPlacement &from);
+std::string describe_placement(const JobPlacement &placement);
+bool apply_placement(const JobPlacement &placement, std::vector<pid_t> pids, pid_t pgid, const char *who);
+int ulimit_builtin(char **args);
+double seconds_since(const struct timespec &start);
+void shell_usage(struct rusage &usage);
+void usage_since(struct rusage &usage, const struct rusage &before);
+std::string json_string(const std::string &s);
+void print_time_report(const std::vector<StageUsage> &stages, double real, const std::string &command, TimeFormat format);
+bool trace_start(const std::string &path);
+void trace_stop();
+long long trace_now();
+void trace_span(const char *name, long long start, pid_t pid, pid_t pgid, int jid, const std::string &command);
+void trace_mark(const char *name, pid_t pid, pid_t pgid, int jid, const std::string &command);
+void trace_track_name(pid_t pid, const std::string &name);
 void print_banner_R(void);
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+// Builtin benchmark: command lines per second for the fork-free builtins
+// against the same commands run as external binaries, alone and as the
+// first stage of a pipeline (where the builtin runs on a thread).
+//
+// Build: cmake --build <dir> --target builtin_bench
+// Usage: ./builtin_bench [iterations]
+#include "SHELL.h"
+#include <chrono>
+
+static double run(const std::string &line, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        run_command_line(line);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return iterations / elapsed.count();
+}
+
+static void compare(const char *what, const std::string &builtin, const std::string &external, int iterations)
+{
+    double builtin_rate = run(builtin, iterations);
+    double external_rate = run(external, iterations);
+    std::cout << what << std::endl;
+    std::cout << "  builtin:  " << (long)builtin_rate << " cmds/s   (" << builtin << ")" << std::endl;
+    std::cout << "  external: " << (long)external_rate << " cmds/s   (" << external << ")" << std::endl;
+    std::cout << "  speedup:  " << builtin_rate / external_rate << "x" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    interactive_mode = false;
+
+    std::cout << "iterations: " << iterations << std::endl;
+    compare("simple command", "echo hello > /dev/null", "/bin/echo hello > /dev/null", iterations);
+    compare("test", "[ 1 -lt 2 ]", "/usr/bin/[ 1 -lt 2 ]", iterations);
+    compare("pipeline", "echo hello | cat > /dev/null", "/bin/echo hello | cat > /dev/null", iterations);
+    return 0;
+}
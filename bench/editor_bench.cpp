@@ -0,0 +1,93 @@
+// Line-editor benchmark: write() calls and bytes sent per keystroke by the
+// diff renderer on a long command line, next to the cost of the old
+// per-character echo (one flush per update, one "\b" per character moved).
+//
+// Build: cmake --build <dir> --target editor_bench
+// Usage: ./editor_bench [line-length]
+#include "SHELL.h"
+
+struct Cost
+{
+    long writes = 0;
+    long bytes = 0;
+};
+
+static void report(const char *name, long keys, const Cost &now, const Cost &before)
+{
+    std::cout << name << "\t" << (double)now.writes / keys << "\t\t" << (double)now.bytes / keys << "\t\t"
+              << (double)before.writes / keys << "\t\t" << (double)before.bytes / keys << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int len = argc > 1 ? std::atoi(argv[1]) : 200;
+    std::string base(len, 'x');
+    std::string out;
+
+    std::cout << "keystroke\twrites/key\tbytes/key\told writes/key\told bytes/key" << std::endl;
+
+    // Insert in the middle of the line: old code reprinted the tail, then
+    // sent one "\b" per tail character (2 flushes)
+    {
+        LineView view{base, len / 2};
+        std::string buffer = base;
+        Cost now, before;
+        for (int i = 0; i < len; i++)
+        {
+            int cursor = view.cursor;
+            buffer.insert(cursor, 1, 'y');
+            out.clear();
+            render_line_diff(view, buffer, cursor + 1, out);
+            now.writes += !out.empty();
+            now.bytes += out.size();
+
+            long tail = buffer.size() - cursor;
+            before.writes += 2;
+            before.bytes += tail + (tail - 1);
+        }
+        report("mid insert", len, now, before);
+    }
+
+    // Backspace in the middle: old code sent "\b", the tail, a space and a
+    // "\b" per character (3 flushes)
+    {
+        std::string buffer = base + base;
+        LineView view{buffer, (int)buffer.size() - len / 2};
+        Cost now, before;
+        for (int i = 0; i < len; i++)
+        {
+            int cursor = view.cursor - 1;
+            buffer.erase(cursor, 1);
+            out.clear();
+            render_line_diff(view, buffer, cursor, out);
+            now.writes += !out.empty();
+            now.bytes += out.size();
+
+            long tail = buffer.size() - cursor;
+            before.writes += 3;
+            before.bytes += 1 + tail + 1 + (tail + 1);
+        }
+        report("backspace", len, now, before);
+    }
+
+    // History Up: old code erased with one "\b \b" flush per character,
+    // then printed the entry
+    {
+        std::string a = base, b = base.substr(0, len / 2) + std::string(len / 2, 'z');
+        LineView view{a, len};
+        Cost now, before;
+        for (int i = 0; i < len; i++)
+        {
+            const std::string &next = (i % 2 == 0) ? b : a;
+            out.clear();
+            render_line_diff(view, next, next.size(), out);
+            now.writes += !out.empty();
+            now.bytes += out.size();
+
+            before.writes += len + 1;
+            before.bytes += 3 * len + next.size();
+        }
+        report("history", len, now, before);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Launch-path benchmark: commands per second for the posix_spawn and fork
+// backends of launch_command(), optionally with a large resident heap so
+// the cost of copying the parent's page tables shows up.
+//
+// Build: cmake --build <dir> --target launch_bench
+// Usage: ./launch_bench [iterations] [ballast-MiB]
+#include "SHELL.h"
+#include <chrono>
+
+static double run(LaunchBackend backend, int iterations)
+{
+    launch_backend = backend;
+    LaunchSpec spec; // stay in our process group, inherit stdio
+    Argv args;
+    args.arena = std::string("true") + '\0';
+    args.finish();
+    std::vector<Redirect> no_redirects;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        int fail_status = 0;
+        pid_t pid = launch_command(args, no_redirects, spec, fail_status);
+        if (pid < 0)
+        {
+            std::cerr << "launch failed" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return iterations / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    size_t ballast_mb = argc > 2 ? std::atoi(argv[2]) : 256;
+    interactive_mode = false;
+
+    // Touch every page so it is really resident in the parent
+    std::vector<char> ballast(ballast_mb * 1024 * 1024);
+    for (size_t i = 0; i < ballast.size(); i += 4096)
+        ballast[i] = 1;
+
+    double spawn_rate = run(LAUNCH_SPAWN, iterations);
+    double fork_rate = run(LAUNCH_FORK, iterations);
+
+    std::cout << "iterations: " << iterations << ", ballast: " << ballast_mb << " MiB" << std::endl;
+    std::cout << "spawn: " << (long)spawn_rate << " cmds/s" << std::endl;
+    std::cout << "fork:  " << (long)fork_rate << " cmds/s" << std::endl;
+    std::cout << "speedup: " << spawn_rate / fork_rate << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,55 @@
+// Microbenchmarks for the per-command hot paths: trim(), the parser on the
+// shapes of line the old split_commands / split_pipes / tokenize_input
+// passes handled (they are now one pass, parse_command_line), and
+// find_longest_common_prefix() on a completion-sized match list.
+// Reports nanoseconds per call.
+//
+// Build: cmake --build <dir> --target micro_bench
+// Usage: ./micro_bench [iterations]
+#include "SHELL.h"
+#include <chrono>
+#include <cstdio>
+
+static volatile size_t sink; // keeps results alive so the calls are not optimized out
+
+template <typename F>
+static void bench(const char *name, long iterations, F body)
+{
+    for (long i = 0; i < iterations / 10; i++) // warm up
+        body();
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+        body();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-32s %10.1f ns/op\n", name, elapsed.count() / iterations);
+}
+
+static void bench_parse(const char *name, long iterations, const std::string &line)
+{
+    Node tree;
+    std::string error;
+    bench(name, iterations, [&] {
+        tree = Node();
+        sink = parse_command_line(line, tree, error) + tree.children.size();
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? std::atol(argv[1]) : 1000000;
+
+    std::string padded = "   ls -la /usr/local/bin   \t";
+    bench("trim", iterations, [&] { sink = trim(padded).size(); });
+
+    bench_parse("parse: list (split_commands)", iterations, "cd /tmp; make -j8 && ./run --fast || echo failed &");
+    bench_parse("parse: pipeline (split_pipes)", iterations, "cat access.log | grep GET | sort | uniq -c | sort -rn | head");
+    bench_parse("parse: words (tokenize_input)", iterations,
+                "grep -rn \"hello world\" 'src dir' --include=*.cpp arg\\ with\\ spaces > out.txt 2>>err.log");
+
+    // What a Tab in /usr/bin with a one-letter prefix might produce
+    std::vector<std::string> matches;
+    for (int i = 0; i < 200; i++)
+        matches.push_back("python3." + std::to_string(i) + "-config");
+    bench("find_longest_common_prefix (200)", iterations / 100, [&] { sink = find_longest_common_prefix(matches).size(); });
+    return 0;
+}
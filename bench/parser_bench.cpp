@@ -0,0 +1,55 @@
+// Parser throughput benchmark: parses generated multi-kilobyte command
+// lines with parse_command_line() and reports MB/s and lines/s per size.
+// Throughput should stay flat as lines grow (the parser is single-pass).
+//
+// Build: cmake --build <dir> --target parser_bench
+// Usage: ./parser_bench [total-MiB-per-size]
+#include "SHELL.h"
+#include <chrono>
+
+// Builds a line of roughly 'size' bytes mixing pipes, && / ||, quoting
+// (with operators inside the quotes) and redirections.
+static std::string make_line(size_t size)
+{
+    std::string line;
+    for (int i = 0; line.size() < size; i++)
+    {
+        if (i > 0)
+            line += (i % 3 == 0) ? " && " : (i % 3 == 1) ? " | " : " || ";
+        line += "cmd" + std::to_string(i) + " --flag=" + std::to_string(i * 7) +
+                " \"quoted | text && more\" 'single; quoted' arg\\ with\\ spaces $HOME";
+        if (i % 5 == 0)
+            line += " > out" + std::to_string(i) + ".log 2>>err.log";
+    }
+    return line;
+}
+
+int main(int argc, char *argv[])
+{
+    double total_mb = argc > 1 ? std::atof(argv[1]) : 64;
+    const size_t sizes[] = {1024, 4096, 16384, 65536};
+
+    std::cout << "line bytes\tlines/s\t\tMB/s" << std::endl;
+    for (size_t size : sizes)
+    {
+        std::string line = make_line(size);
+        long iterations = (long)(total_mb * 1024 * 1024 / line.size()) + 1;
+
+        Node tree;
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++)
+        {
+            if (parse_command_line(line, tree, error) != PARSE_OK)
+            {
+                std::cerr << "parse failed: " << error << std::endl;
+                return 1;
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << line.size() << "\t\t" << (long)(iterations / elapsed.count()) << "\t\t"
+                  << (iterations * line.size()) / elapsed.count() / (1024 * 1024) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,237 @@
+// End-to-end benchmark: starts the shell on a pseudo-terminal and types
+// commands at it, waiting for the next prompt each time like a user would.
+// Measures startup time, commands per second (builtin and external),
+// pipeline setup latency, and RSS growth over a long run of distinct
+// command lines (100k by default). Results go to stdout and to a
+// "metric<TAB>value<TAB>unit" file that can be compared between revisions.
+//
+// Build: cmake --build <dir> --target pty_harness   (or: --target bench_e2e)
+// Usage: ./pty_harness <shell-binary> [results-file] [commands]
+//        ./pty_harness --compare old.tsv new.tsv
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <pty.h>
+#include <signal.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// The tail of the shell's prompt: "<cwd> $ " followed by the color reset
+static const std::string PROMPT_END = " $ \033[0m";
+
+struct Metric
+{
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+static int pty_fd = -1;
+static pid_t shell_pid = -1;
+static std::string pending; // output read but not matched yet
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reads until the next prompt shows up; false on timeout or EOF
+static bool wait_prompt()
+{
+    char buf[64 * 1024];
+    while (true)
+    {
+        size_t found = pending.find(PROMPT_END);
+        if (found != std::string::npos)
+        {
+            pending.erase(0, found + PROMPT_END.size());
+            return true;
+        }
+        // Keep only what could be the start of a split prompt
+        if (pending.size() > PROMPT_END.size())
+            pending.erase(0, pending.size() - PROMPT_END.size());
+
+        struct pollfd pfd = {pty_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 10000) <= 0)
+            return false;
+        ssize_t n = read(pty_fd, buf, sizeof(buf));
+        if (n <= 0)
+            return false;
+        pending.append(buf, n);
+    }
+}
+
+static bool type_line(const std::string &line)
+{
+    std::string keys = line + "\r";
+    return write(pty_fd, keys.data(), keys.size()) == (ssize_t)keys.size() && wait_prompt();
+}
+
+// Seconds to run 'count' command lines made by make(i), one prompt each
+template <typename F>
+static double run_lines(long count, F make)
+{
+    double start = now();
+    for (long i = 0; i < count; i++)
+    {
+        if (!type_line(make(i)))
+        {
+            std::cerr << "pty_harness: shell stopped responding at line " << i << std::endl;
+            exit(1);
+        }
+    }
+    return now() - start;
+}
+
+static long rss_kb(pid_t pid)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::atol(line.c_str() + 6);
+    }
+    return -1;
+}
+
+static bool start_shell(const char *shell, const std::string &histfile)
+{
+    struct winsize ws = {};
+    ws.ws_row = 40;
+    ws.ws_col = 200;
+    shell_pid = forkpty(&pty_fd, NULL, NULL, &ws);
+    if (shell_pid < 0)
+    {
+        perror("forkpty");
+        return false;
+    }
+    if (shell_pid == 0)
+    {
+        // A throwaway history file, and no tracing to slow things down
+        setenv("HISTFILE", histfile.c_str(), 1);
+        setenv("TERM", "xterm", 1);
+        unsetenv("SIMPLE_SHELL_TRACE");
+        execl(shell, shell, (char *)NULL);
+        perror("exec");
+        _exit(127);
+    }
+    return true;
+}
+
+static bool read_results(const char *path, std::map<std::string, std::pair<double, std::string>> &out)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "pty_harness: cannot read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name, unit;
+        double value;
+        if (std::getline(fields, name, '\t') && fields >> value)
+        {
+            fields >> unit;
+            out[name] = {value, unit};
+        }
+    }
+    return true;
+}
+
+static int compare(const char *old_path, const char *new_path)
+{
+    std::map<std::string, std::pair<double, std::string>> before, after;
+    if (!read_results(old_path, before) || !read_results(new_path, after))
+        return 1;
+
+    printf("%-28s %14s %14s %9s\n", "metric", "old", "new", "change");
+    for (const auto &entry : after)
+    {
+        auto old = before.find(entry.first);
+        if (old == before.end())
+        {
+            printf("%-28s %14s %14.2f %9s  %s\n", entry.first.c_str(), "-", entry.second.first, "", entry.second.second.c_str());
+            continue;
+        }
+        double change = old->second.first != 0 ? (entry.second.first - old->second.first) / std::fabs(old->second.first) * 100 : 0;
+        printf("%-28s %14.2f %14.2f %+8.1f%%  %s\n", entry.first.c_str(), old->second.first, entry.second.first,
+               change, entry.second.second.c_str());
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 4 && strcmp(argv[1], "--compare") == 0)
+        return compare(argv[2], argv[3]);
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <shell-binary> [results-file] [commands]\n"
+                  << "       " << argv[0] << " --compare old.tsv new.tsv" << std::endl;
+        return 2;
+    }
+    const char *shell = argv[1];
+    const char *results_path = argc > 2 ? argv[2] : "bench_results.tsv";
+    long commands = argc > 3 ? std::atol(argv[3]) : 100000;
+    long short_runs = std::max(1L, std::min(commands, 2000L));
+
+    std::string histfile = "/tmp/pty_harness_history." + std::to_string(getpid());
+    std::vector<Metric> metrics;
+
+    double start = now();
+    if (!start_shell(shell, histfile) || !wait_prompt())
+    {
+        std::cerr << "pty_harness: no prompt from " << shell << std::endl;
+        return 1;
+    }
+    metrics.push_back({"startup", (now() - start) * 1000, "ms"});
+
+    double t = run_lines(short_runs, [](long) { return std::string("true"); });
+    metrics.push_back({"builtin_commands", short_runs / t, "cmds/s"});
+
+    t = run_lines(short_runs, [](long) { return std::string("/bin/true"); });
+    metrics.push_back({"external_commands", short_runs / t, "cmds/s"});
+
+    t = run_lines(short_runs, [](long) { return std::string("/bin/true | /bin/true | /bin/true"); });
+    metrics.push_back({"pipeline_setup_3_stages", t / short_runs * 1000, "ms"});
+
+    // Distinct lines, so history and the other caches see real growth
+    long rss_before = rss_kb(shell_pid);
+    t = run_lines(commands, [](long i) { return "true " + std::to_string(i); });
+    long rss_after = rss_kb(shell_pid);
+    metrics.push_back({"long_run_commands", commands / t, "cmds/s"});
+    metrics.push_back({"rss_start", (double)rss_before, "KiB"});
+    metrics.push_back({"rss_end", (double)rss_after, "KiB"});
+    metrics.push_back({"rss_growth", (double)(rss_after - rss_before), "KiB"});
+
+    if (write(pty_fd, "exit\r", 5) != 5)
+        kill(shell_pid, SIGKILL);
+    close(pty_fd);
+    waitpid(shell_pid, NULL, 0);
+    unlink(histfile.c_str());
+
+    std::ofstream out(results_path);
+    out << "# pty_harness " << shell << " (" << commands << " commands)\n";
+    for (const Metric &m : metrics)
+    {
+        printf("%-28s %14.2f  %s\n", m.name.c_str(), m.value, m.unit.c_str());
+        out << m.name << '\t' << m.value << '\t' << m.unit << '\n';
+    }
+    std::cout << "results written to " << results_path << std::endl;
+    return 0;
+}
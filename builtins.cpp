@@ -0,0 +1,555 @@
+// Library includes
+#include "SHELL.h"
+#include <sys/stat.h>
+
+// Builtins that replace common utilities (echo, printf, test/[, true,
+// false, pwd, read) so scripts don't pay a fork + exec for each of them.
+// They only use the fds in BuiltinIO and never std::cout, so inside a
+// pipeline they can run on a thread bound to the pipe fds (see
+// execute_pipeline) while the shell's own stdout stays untouched.
+
+static const char *fork_free_builtins[] = {"echo", "printf", "test", "[", "true", ":", "false", "pwd", "read"};
+
+bool is_fork_free_builtin(const char *name)
+{
+    for (const char *b : fork_free_builtins)
+    {
+        if (strcmp(name, b) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void print_error(const BuiltinIO &io, const std::string &message)
+{
+    std::string line = std::string(RED) + message + RESET + "\n";
+    write_all(io.err, line.data(), line.size());
+}
+
+// Writes out; false if that failed (e.g. the reader went away)
+static bool write_out(const BuiltinIO &io, const std::string &out)
+{
+    return write_all(io.out, out.data(), out.size());
+}
+
+// Appends the character for the escape at s[i] (just after the
+// backslash) and advances i past it. Returns false for "\c": stop output.
+static bool append_escape(const char *s, size_t &i, std::string &out)
+{
+    char c = s[i++];
+    switch (c)
+    {
+    case 'n': out += '\n'; break;
+    case 't': out += '\t'; break;
+    case 'r': out += '\r'; break;
+    case 'a': out += '\a'; break;
+    case 'b': out += '\b'; break;
+    case 'f': out += '\f'; break;
+    case 'v': out += '\v'; break;
+    case 'e': out += '\033'; break;
+    case '\\': out += '\\'; break;
+    case 'c': return false;
+    case '0':
+    {
+        // \0NNN: up to three octal digits
+        int value = 0;
+        for (int n = 0; n < 3 && s[i] >= '0' && s[i] <= '7'; n++)
+            value = value * 8 + (s[i++] - '0');
+        out += (char)value;
+        break;
+    }
+    case '\0':
+        out += '\\';
+        i--;
+        break;
+    default:
+        out += '\\';
+        out += c;
+        break;
+    }
+    return true;
+}
+
+static int builtin_echo(char **args, const BuiltinIO &io)
+{
+    bool newline = true;
+    bool escapes = false;
+    size_t i = 1;
+
+    // Flags like -n, -e, -E and combinations ("-ne"); anything else is text
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        const char *flag = args[i] + 1;
+        if (strspn(flag, "neE") != strlen(flag))
+            break;
+        for (; *flag; flag++)
+        {
+            if (*flag == 'n')
+                newline = false;
+            else
+                escapes = *flag == 'e';
+        }
+    }
+
+    std::string out;
+    for (size_t first = i; args[i] != NULL; i++)
+    {
+        if (i > first)
+            out += ' ';
+        if (!escapes)
+        {
+            out += args[i];
+            continue;
+        }
+        const char *s = args[i];
+        for (size_t j = 0; s[j] != '\0';)
+        {
+            if (s[j] != '\\')
+            {
+                out += s[j++];
+                continue;
+            }
+            j++;
+            if (!append_escape(s, j, out))
+                return write_out(io, out) ? 0 : 1;
+        }
+    }
+    if (newline)
+        out += '\n';
+    return write_out(io, out) ? 0 : 1;
+}
+
+// One printf conversion (spec is e.g. "%-8.3s") applied to arg
+static bool format_one(const BuiltinIO &io, std::string spec, char conv, const char *arg, std::string &out)
+{
+    char buf[512];
+    int n = 0;
+    bool ok = true;
+
+    if (conv == 's')
+    {
+        spec += 's';
+        n = snprintf(buf, sizeof(buf), spec.c_str(), arg);
+        if (n >= (int)sizeof(buf))
+        {
+            // Long strings: only padding needs snprintf, so build it directly
+            out += arg;
+            return true;
+        }
+    }
+    else if (conv == 'c')
+    {
+        spec += 'c';
+        n = snprintf(buf, sizeof(buf), spec.c_str(), arg[0]);
+    }
+    else if (strchr("diouxX", conv))
+    {
+        long long value = 0;
+        if (arg[0] == '\'' || arg[0] == '"')
+            value = (unsigned char)arg[1]; // 'a -> character code
+        else if (arg[0] != '\0')
+        {
+            char *end;
+            errno = 0;
+            value = strtoll(arg, &end, 0);
+            if (*end != '\0' || errno != 0)
+            {
+                print_error(io, std::string("printf: ") + arg + ": invalid number");
+                ok = false;
+            }
+        }
+        spec += "ll";
+        spec += conv;
+        n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    }
+    else // e f g E G
+    {
+        char *end;
+        double value = arg[0] != '\0' ? strtod(arg, &end) : 0.0;
+        if (arg[0] != '\0' && *end != '\0')
+        {
+            print_error(io, std::string("printf: ") + arg + ": invalid number");
+            ok = false;
+        }
+        spec += conv;
+        n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    }
+
+    if (n > 0)
+        out.append(buf, std::min(n, (int)sizeof(buf) - 1));
+    return ok;
+}
+
+static int builtin_printf(char **args, const BuiltinIO &io)
+{
+    if (args[1] == NULL)
+    {
+        print_error(io, "printf: usage: printf format [arguments]");
+        return 2;
+    }
+
+    const char *fmt = args[1];
+    size_t argi = 2;
+    int status = 0;
+    std::string out;
+
+    // The format is reused until every argument has been consumed
+    do
+    {
+        size_t before = argi;
+        for (size_t i = 0; fmt[i] != '\0';)
+        {
+            if (fmt[i] == '\\')
+            {
+                i++;
+                if (!append_escape(fmt, i, out))
+                    return write_out(io, out) ? status : 1;
+                continue;
+            }
+            if (fmt[i] != '%')
+            {
+                out += fmt[i++];
+                continue;
+            }
+            if (fmt[i + 1] == '%')
+            {
+                out += '%';
+                i += 2;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion
+            size_t start = i++;
+            i += strspn(fmt + i, "-+ #0");
+            i += strspn(fmt + i, "0123456789");
+            if (fmt[i] == '.')
+            {
+                i++;
+                i += strspn(fmt + i, "0123456789");
+            }
+            char conv = fmt[i];
+            if (conv == '\0' || !strchr("diouxXcsbeEfgG", conv))
+            {
+                print_error(io, std::string("printf: invalid format: ") + fmt);
+                write_out(io, out);
+                return 1;
+            }
+            std::string spec(fmt + start, i - start);
+            i++;
+
+            const char *arg = args[argi] != NULL ? args[argi++] : "";
+            if (conv == 'b')
+            {
+                // %b: the argument with its escapes interpreted
+                std::string expanded;
+                bool more = true;
+                for (size_t j = 0; arg[j] != '\0' && more;)
+                {
+                    if (arg[j] == '\\')
+                    {
+                        j++;
+                        more = append_escape(arg, j, expanded);
+                    }
+                    else
+                        expanded += arg[j++];
+                }
+                format_one(io, spec, 's', expanded.c_str(), out);
+                if (!more)
+                    return write_out(io, out) ? status : 1;
+            }
+            else if (!format_one(io, spec, conv, arg, out))
+                status = 1;
+        }
+        if (argi == before)
+            break; // the format took no arguments
+    } while (args[argi] != NULL);
+
+    return write_out(io, out) ? status : 1;
+}
+
+// --- test / [ ---
+
+struct TestParser
+{
+    std::vector<std::string> words;
+    size_t pos;
+    bool error;
+};
+
+static bool test_unary(const std::string &op, const std::string &arg)
+{
+    struct stat st;
+    if (op == "-z")
+        return arg.empty();
+    if (op == "-n")
+        return !arg.empty();
+    if (op == "-t")
+        return isatty(std::atoi(arg.c_str()));
+    if (op == "-r")
+        return access(arg.c_str(), R_OK) == 0;
+    if (op == "-w")
+        return access(arg.c_str(), W_OK) == 0;
+    if (op == "-x")
+        return access(arg.c_str(), X_OK) == 0;
+    if (op == "-L" || op == "-h")
+        return lstat(arg.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+
+    if (stat(arg.c_str(), &st) != 0)
+        return false;
+    if (op == "-e")
+        return true;
+    if (op == "-f")
+        return S_ISREG(st.st_mode);
+    if (op == "-d")
+        return S_ISDIR(st.st_mode);
+    if (op == "-s")
+        return st.st_size > 0;
+    if (op == "-p")
+        return S_ISFIFO(st.st_mode);
+    return false;
+}
+
+static bool is_unary_op(const std::string &op)
+{
+    static const char *ops[] = {"-z", "-n", "-t", "-r", "-w", "-x", "-L", "-h", "-e", "-f", "-d", "-s", "-p"};
+    for (const char *o : ops)
+    {
+        if (op == o)
+            return true;
+    }
+    return false;
+}
+
+static bool is_binary_op(const std::string &op)
+{
+    static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    for (const char *o : ops)
+    {
+        if (op == o)
+            return true;
+    }
+    return false;
+}
+
+static bool test_binary(TestParser &p, const std::string &a, const std::string &op, const std::string &b)
+{
+    if (op == "=" || op == "==")
+        return a == b;
+    if (op == "!=")
+        return a != b;
+    if (op == "<")
+        return a < b;
+    if (op == ">")
+        return a > b;
+
+    char *end_a, *end_b;
+    long long x = strtoll(a.c_str(), &end_a, 10);
+    long long y = strtoll(b.c_str(), &end_b, 10);
+    if (a.empty() || b.empty() || *end_a != '\0' || *end_b != '\0')
+    {
+        p.error = true; // integer expression expected
+        return false;
+    }
+    if (op == "-eq")
+        return x == y;
+    if (op == "-ne")
+        return x != y;
+    if (op == "-lt")
+        return x < y;
+    if (op == "-le")
+        return x <= y;
+    if (op == "-gt")
+        return x > y;
+    return x >= y; // -ge
+}
+
+static bool test_or(TestParser &p);
+
+static bool test_primary(TestParser &p)
+{
+    std::vector<std::string> &w = p.words;
+    if (p.pos >= w.size())
+    {
+        p.error = true;
+        return false;
+    }
+
+    if (w[p.pos] == "!")
+    {
+        p.pos++;
+        return !test_primary(p);
+    }
+    if (w[p.pos] == "(")
+    {
+        p.pos++;
+        bool result = test_or(p);
+        if (p.pos >= w.size() || w[p.pos] != ")")
+            p.error = true;
+        p.pos++;
+        return result;
+    }
+    if (p.pos + 2 < w.size() && is_binary_op(w[p.pos + 1]))
+    {
+        bool result = test_binary(p, w[p.pos], w[p.pos + 1], w[p.pos + 2]);
+        p.pos += 3;
+        return result;
+    }
+    if (is_unary_op(w[p.pos]) && p.pos + 1 < w.size())
+    {
+        bool result = test_unary(w[p.pos], w[p.pos + 1]);
+        p.pos += 2;
+        return result;
+    }
+    // A lone word is true when it is not empty
+    return !w[p.pos++].empty();
+}
+
+static bool test_and(TestParser &p)
+{
+    bool result = test_primary(p);
+    while (p.pos < p.words.size() && p.words[p.pos] == "-a")
+    {
+        p.pos++;
+        bool rhs = test_primary(p);
+        result = result && rhs;
+    }
+    return result;
+}
+
+static bool test_or(TestParser &p)
+{
+    bool result = test_and(p);
+    while (p.pos < p.words.size() && p.words[p.pos] == "-o")
+    {
+        p.pos++;
+        bool rhs = test_and(p);
+        result = result || rhs;
+    }
+    return result;
+}
+
+static int builtin_test(char **args, const BuiltinIO &io)
+{
+    TestParser p{{}, 0, false};
+    for (size_t i = 1; args[i] != NULL; i++)
+        p.words.push_back(args[i]);
+
+    std::string name = args[0];
+    if (name == "[")
+    {
+        if (p.words.empty() || p.words.back() != "]")
+        {
+            print_error(io, "[: missing `]'");
+            return 2;
+        }
+        p.words.pop_back();
+    }
+    if (p.words.empty())
+        return 1; // no expression is false
+
+    bool result = test_or(p);
+    if (p.error || p.pos != p.words.size())
+    {
+        print_error(io, name + ": invalid expression");
+        return 2;
+    }
+    return result ? 0 : 1;
+}
+
+static int builtin_pwd(const BuiltinIO &io)
+{
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        print_error(io, "pwd: Error getting current working directory");
+        return 1;
+    }
+    return write_out(io, std::string(cwd) + "\n") ? 0 : 1;
+}
+
+// read [-r] [name...]: one line from io.in, split on blanks into the
+// names (the last one gets the rest, REPLY if none are given)
+static int builtin_read(char **args, const BuiltinIO &io)
+{
+    bool raw = false;
+    size_t i = 1;
+    if (args[i] != NULL && strcmp(args[i], "-r") == 0)
+    {
+        raw = true;
+        i++;
+    }
+    std::vector<std::string> names;
+    for (; args[i] != NULL; i++)
+        names.push_back(args[i]);
+    if (names.empty())
+        names.push_back("REPLY");
+
+    // Byte by byte, so nothing after the newline is taken from a shared fd
+    std::string line;
+    bool got_newline = false;
+    char c;
+    while (true)
+    {
+        ssize_t n = read(io.in, &c, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (c == '\n')
+        {
+            got_newline = true;
+            break;
+        }
+        if (c == '\\' && !raw)
+        {
+            if (read(io.in, &c, 1) != 1)
+                break;
+            if (c == '\n')
+                continue; // line continuation
+        }
+        line += c;
+    }
+
+    // Split into fields; the last name takes the rest of the line
+    std::vector<std::string> values(names.size());
+    size_t pos = line.find_first_not_of(" \t");
+    for (size_t k = 0; k < names.size() && pos != std::string::npos; k++)
+    {
+        if (k + 1 == names.size())
+        {
+            values[k] = trim(line.substr(pos));
+            break;
+        }
+        size_t end = line.find_first_of(" \t", pos);
+        values[k] = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end == std::string::npos ? end : line.find_first_not_of(" \t", end);
+    }
+
+    // On a pipeline thread there is no assignment, as in a subshell
+    if (!io.in_thread)
+    {
+        for (size_t k = 0; k < names.size(); k++)
+            var_set(names[k], values[k]);
+    }
+    return got_newline || !line.empty() ? 0 : 1;
+}
+
+int run_fork_free_builtin(char **args, const BuiltinIO &io)
+{
+    std::string cmd = args[0];
+    if (cmd == "echo")
+        return builtin_echo(args, io);
+    if (cmd == "printf")
+        return builtin_printf(args, io);
+    if (cmd == "test" || cmd == "[")
+        return builtin_test(args, io);
+    if (cmd == "true" || cmd == ":")
+        return 0;
+    if (cmd == "false")
+        return 1;
+    if (cmd == "pwd")
+        return builtin_pwd(io);
+    if (cmd == "read")
+        return builtin_read(args, io);
+    return 127;
+}
@@ -0,0 +1,293 @@
+// Library includes
+#include "SHELL.h"
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+// Index of the executables on $PATH for command-name completion. A
+// background thread scans the PATH directories into a prefix trie and
+// then follows them with inotify, updating the trie one name at a time.
+// The Tab key only ever takes the lock for a lookup; when the index is
+// not built yet it simply offers fewer names.
+
+struct TrieNode
+{
+    std::vector<std::pair<char, int>> next; // sorted by char; index into nodes
+    int count = 0; // PATH directories that have a command ending here
+};
+
+struct CommandTrie
+{
+    std::vector<TrieNode> nodes = std::vector<TrieNode>(1); // nodes[0] is the root
+
+    int child(int node, char c, bool create)
+    {
+        std::vector<std::pair<char, int>> &next = nodes[node].next;
+        auto it = std::lower_bound(next.begin(), next.end(), std::make_pair(c, 0));
+        if (it != next.end() && it->first == c)
+            return it->second;
+        if (!create)
+            return -1;
+        int id = nodes.size();
+        next.insert(it, {c, id}); // may reallocate next, not nodes
+        nodes.emplace_back();
+        return id;
+    }
+
+    void add(const std::string &name)
+    {
+        int node = 0;
+        for (char c : name)
+            node = child(node, c, true);
+        nodes[node].count++;
+    }
+
+    void remove(const std::string &name)
+    {
+        int node = 0;
+        for (char c : name)
+        {
+            node = child(node, c, false);
+            if (node < 0)
+                return;
+        }
+        if (nodes[node].count > 0)
+            nodes[node].count--; // the empty branch stays; it is cheap
+    }
+
+    // Every name below node, in sorted order
+    void collect(int node, std::string &name, std::vector<std::string> &out) const
+    {
+        if (nodes[node].count > 0)
+            out.push_back(name);
+        for (const auto &edge : nodes[node].next)
+        {
+            name += edge.first;
+            collect(edge.second, name, out);
+            name.pop_back();
+        }
+    }
+};
+
+// Shared with the index thread, guarded by index_mutex
+static std::mutex index_mutex;
+static CommandTrie index_trie;
+static std::string index_path;  // PATH the index should follow
+static bool index_stale = false; // index_path changed since the last scan
+
+static int wake_pipe[2] = {-1, -1}; // tells the thread PATH changed
+
+// Thread-only state: what each watched directory contributes
+struct WatchedDir
+{
+    std::string path;
+    std::unordered_set<std::string> names;
+};
+
+static bool is_command_file(int dir_fd, const char *name)
+{
+    struct stat st;
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+           faccessat(dir_fd, name, X_OK, 0) == 0;
+}
+
+static void scan_dir(WatchedDir &dir)
+{
+    dir.names.clear();
+    DIR *d = opendir(dir.path.c_str());
+    if (d == NULL)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR)
+            continue;
+        if (is_command_file(dirfd(d), entry->d_name))
+            dir.names.insert(entry->d_name);
+    }
+    closedir(d);
+}
+
+// Full rescan for a new PATH. The trie is built without the lock and
+// swapped in, so completion is never held up by the scan.
+static void rebuild_index(int inotify_fd, std::unordered_map<int, WatchedDir> &watched)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        path = index_path;
+        index_stale = false;
+    }
+
+    for (const auto &w : watched)
+        inotify_rm_watch(inotify_fd, w.first);
+    watched.clear();
+
+    CommandTrie trie;
+    std::unordered_set<std::string> seen_dirs;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        size_t end = path.find(':', start);
+        if (end == std::string::npos)
+            end = path.size();
+        std::string dir = path.substr(start, end - start);
+        start = end + 1;
+
+        // Relative entries ("" and ".") depend on the cwd; leave them to
+        // file completion
+        if (dir.empty() || dir[0] != '/' || !seen_dirs.insert(dir).second)
+            continue;
+
+        int wd = inotify_add_watch(inotify_fd, dir.c_str(),
+                                   IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        WatchedDir scanned;
+        scanned.path = dir;
+        scan_dir(scanned);
+        for (const std::string &name : scanned.names)
+            trie.add(name);
+        if (wd >= 0)
+            watched[wd] = std::move(scanned);
+    }
+
+    std::lock_guard<std::mutex> lock(index_mutex);
+    std::swap(index_trie, trie);
+}
+
+// One inotify event: re-check that single name
+static void apply_event(const struct inotify_event *ev, std::unordered_map<int, WatchedDir> &watched)
+{
+    auto it = watched.find(ev->wd);
+    if (it == watched.end() || ev->len == 0)
+        return;
+    WatchedDir &dir = it->second;
+    std::string name = ev->name;
+
+    bool present = false;
+    if (!(ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+    {
+        int dir_fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0)
+        {
+            present = is_command_file(dir_fd, name.c_str());
+            close(dir_fd);
+        }
+    }
+
+    bool known = dir.names.count(name) > 0;
+    if (present == known)
+        return;
+
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (present)
+    {
+        dir.names.insert(name);
+        index_trie.add(name);
+    }
+    else
+    {
+        dir.names.erase(name);
+        index_trie.remove(name);
+    }
+}
+
+static void index_thread_main()
+{
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    std::unordered_map<int, WatchedDir> watched; // watch descriptor -> dir
+    rebuild_index(inotify_fd, watched);
+    if (inotify_fd < 0)
+        return; // a one-off scan is all we can do
+
+    std::vector<char> buf(64 * 1024);
+    struct pollfd fds[2];
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_pipe[0];
+    fds[1].events = POLLIN;
+
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+
+        bool rescan = false;
+        if (fds[0].revents & POLLIN)
+        {
+            ssize_t n = read(inotify_fd, buf.data(), buf.size());
+            for (ssize_t off = 0; off < n;)
+            {
+                const struct inotify_event *ev = (const struct inotify_event *)(buf.data() + off);
+                if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF))
+                    rescan = true; // lost track of something: start over
+                else
+                    apply_event(ev, watched);
+                off += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(index_mutex);
+            rescan = rescan || index_stale;
+        }
+        if (rescan)
+            rebuild_index(inotify_fd, watched);
+    }
+}
+
+void start_command_index()
+{
+    const std::string *env_path = var_get("PATH");
+    index_path = env_path != nullptr ? *env_path : "/usr/local/bin:/usr/bin:/bin";
+
+    if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        return;
+    // Started after SIGCHLD is blocked, so the thread inherits the mask
+    std::thread(index_thread_main).detach();
+}
+
+void refresh_command_index()
+{
+    if (wake_pipe[1] < 0)
+        return;
+    const std::string *env_path = var_get("PATH");
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        index_path = env_path != nullptr ? *env_path : "";
+        index_stale = true;
+    }
+    char c = 1;
+    if (write(wake_pipe[1], &c, 1) < 0)
+    {
+        // Pipe full: a wakeup is already pending
+    }
+}
+
+void get_command_completions(const std::string &prefix, std::vector<std::string> &matches)
+{
+    std::lock_guard<std::mutex> lock(index_mutex);
+    int node = 0;
+    for (char c : prefix)
+    {
+        node = index_trie.child(node, c, false);
+        if (node < 0)
+            return;
+    }
+    std::string name = prefix;
+    index_trie.collect(node, name, matches);
+}
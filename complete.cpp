@@ -0,0 +1,275 @@
+// Library includes
+#include "SHELL.h"
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+// File name completion. The word under the cursor is split into a
+// directory part and a name prefix ("src/foo/ba" -> "src/foo/" + "ba").
+// Each directory's listing is read once, sorted, and cached until the
+// directory's mtime changes; matches are then found by binary search, so
+// a Tab in a directory with 100k entries costs one stat() and a lookup.
+
+struct DirEntry
+{
+    std::string name;
+    unsigned char type; // d_type; DT_UNKNOWN / DT_LNK are resolved on use
+};
+
+struct DirListing
+{
+    struct timespec mtime;
+    std::vector<DirEntry> entries; // sorted by name
+};
+
+static const size_t MAX_CACHED_DIRS = 64;
+static std::unordered_map<std::string, DirListing> dir_cache;
+
+// What the last Tab did, so a second Tab on the same line lists matches
+static std::string last_tab_line;
+
+std::string find_longest_common_prefix(std::vector<std::string>& matches)
+{
+    if (matches.empty()) return "";
+
+    std::string prefix = matches[0];
+    for (size_t i = 1; i < matches.size(); ++i)
+    {
+        int len = std::min((int)prefix.length(), (int)matches[i].length());
+        int j = 0;
+        while (j < len && prefix[j] == matches[i][j])
+        {
+            j++;
+        }
+        prefix = prefix.substr(0, j);
+        if (prefix.empty()) return "";
+    }
+    return prefix;
+}
+
+// Returns the cached listing of dir, re-reading it if the directory changed
+static const DirListing *get_listing(const std::string &dir)
+{
+    struct stat st;
+    if (stat(dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode))
+        return nullptr;
+
+    auto it = dir_cache.find(dir);
+    if (it != dir_cache.end() && it->second.mtime.tv_sec == st.st_mtim.tv_sec &&
+        it->second.mtime.tv_nsec == st.st_mtim.tv_nsec)
+        return &it->second;
+
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return nullptr;
+
+    if (it == dir_cache.end() && dir_cache.size() >= MAX_CACHED_DIRS)
+        dir_cache.clear(); // keep the cache bounded; it refills on demand
+
+    DirListing &listing = dir_cache[dir];
+    listing.mtime = st.st_mtim;
+    listing.entries.clear();
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        listing.entries.push_back(DirEntry{entry->d_name, entry->d_type});
+    }
+    closedir(d);
+
+    std::sort(listing.entries.begin(), listing.entries.end(),
+              [](const DirEntry &a, const DirEntry &b) { return a.name < b.name; });
+    return &listing;
+}
+
+static bool is_directory(const std::string &dir, const DirEntry &entry)
+{
+    if (entry.type == DT_DIR)
+        return true;
+    if (entry.type != DT_UNKNOWN && entry.type != DT_LNK)
+        return false;
+    // Some file systems (NFS, XFS) don't fill in d_type; links may point at a dir
+    struct stat st;
+    return stat((dir + "/" + entry.name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Appends every file name matching word to matches, each with the word's
+// directory part in front and a '/' after directories when mark_dirs is set
+static void get_completions(const std::string &word, std::vector<std::string> &matches, bool mark_dirs)
+{
+    size_t slash = word.find_last_of('/');
+    std::string dir_part = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+    std::string prefix = slash == std::string::npos ? word : word.substr(slash + 1);
+
+    std::string dir = dir_part.empty() ? "." : dir_part;
+    const std::string *home = var_get("HOME");
+    if (dir_part.compare(0, 2, "~/") == 0 && home != nullptr)
+        dir = *home + dir_part.substr(1);
+
+    const DirListing *listing = get_listing(dir);
+    if (listing == nullptr)
+        return;
+
+    // All names starting with prefix form one run in the sorted listing
+    auto first = std::lower_bound(listing->entries.begin(), listing->entries.end(), prefix,
+                                  [](const DirEntry &e, const std::string &p) { return e.name < p; });
+    for (auto it = first; it != listing->entries.end(); ++it)
+    {
+        if (it->name.compare(0, prefix.size(), prefix) != 0)
+            break;
+        // Hidden files only when asked for
+        if (it->name[0] == '.' && (prefix.empty() || prefix[0] != '.'))
+            continue;
+
+        std::string match = dir_part + it->name;
+        if (mark_dirs && is_directory(dir, *it))
+            match += "/";
+        matches.push_back(match);
+    }
+}
+
+// Prints matches in columns below the current line
+static void list_completions(const std::vector<std::string> &matches)
+{
+    size_t width = 0;
+    for (const std::string &m : matches)
+        width = std::max(width, m.size());
+    width += 2;
+
+    struct winsize ws;
+    size_t term_width = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        term_width = ws.ws_col;
+    size_t columns = std::max<size_t>(1, term_width / width);
+    size_t rows = (matches.size() + columns - 1) / columns;
+
+    // Down the columns, like ls
+    std::string out = "\n";
+    for (size_t row = 0; row < rows; ++row)
+    {
+        for (size_t col = 0; col < columns; ++col)
+        {
+            size_t i = col * rows + row;
+            if (i >= matches.size())
+                break;
+            out += matches[i];
+            if (col + 1 < columns && i + rows < matches.size())
+                out.append(width - matches[i].size(), ' ');
+        }
+        out += "\n";
+    }
+    std::cout << out << std::flush;
+}
+
+// True if the word starting at 'start' is where a command name goes: the
+// first word of the line or the first one after |, ;, & or &&
+static bool is_command_position(const std::string &line, size_t start)
+{
+    size_t prev = line.find_last_not_of(" \t", start == 0 ? std::string::npos : start - 1);
+    if (start == 0 || prev == std::string::npos)
+        return true;
+    char c = line[prev];
+    return c == '|' || c == ';' || c == '&';
+}
+
+bool handle_tab_completion(std::string& cmd_buffer, int& cursor_pos)
+{
+    // For now, we only support tab-completion at the end of the line
+    if (cursor_pos != (int)cmd_buffer.length())
+    {
+        return false; // Too complex to insert in the middle, just return.
+    }
+
+    // 1. Find the word we need to complete
+    size_t start_of_word = cmd_buffer.find_last_of(" ");
+    std::string word_to_complete;
+
+    if (start_of_word == std::string::npos) // No space, it's the first word
+    {
+        word_to_complete = cmd_buffer;
+        start_of_word = 0;
+    }
+    else // It's a word after a space
+    {
+        word_to_complete = cmd_buffer.substr(start_of_word + 1);
+        start_of_word++; // Point index to the start of the word
+    }
+
+    // 2. Get all possible matches ('/' after directories is only needed
+    // for a single match or a listing, which saves stat()s on big dirs)
+    bool second_tab = last_tab_line == cmd_buffer;
+    last_tab_line = cmd_buffer;
+    std::vector<std::string> matches;
+    bool command_word = is_command_position(cmd_buffer, start_of_word) &&
+                        word_to_complete.find('/') == std::string::npos;
+    if (command_word)
+    {
+        // A command name: builtins and everything on $PATH
+        std::vector<std::string> builtin_names;
+        get_builtin_names(builtin_names);
+        for (const std::string &name : builtin_names)
+        {
+            if (name.compare(0, word_to_complete.size(), word_to_complete) == 0)
+                matches.push_back(name);
+        }
+        get_command_completions(word_to_complete, matches);
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    }
+    else
+    {
+        get_completions(word_to_complete, matches, second_tab);
+    }
+
+    if (matches.empty())
+    {
+        return false; // No matches, do nothing
+    }
+
+    std::string part_to_add;
+    if (matches.size() == 1)
+    {
+        // 3a. Only one match: complete the whole thing
+        if (!second_tab && !command_word)
+        {
+            matches.clear();
+            get_completions(word_to_complete, matches, true);
+        }
+        std::string completion = matches[0];
+        part_to_add = completion.substr(word_to_complete.length());
+
+        // Add a space at the end if it's not a directory
+        if (completion.back() != '/')
+        {
+            part_to_add += " ";
+        }
+    }
+    else
+    {
+        // 3b. Multiple matches: complete the longest common prefix
+        std::string prefix = find_longest_common_prefix(matches);
+        if (prefix.length() > word_to_complete.length())
+        {
+            part_to_add = prefix.substr(word_to_complete.length());
+        }
+        else if (second_tab)
+        {
+            // Nothing more to add: on a second tab press, list all options
+            size_t dir_len = word_to_complete.find_last_of('/') + 1; // 0 if none
+            for (std::string &m : matches)
+                m.erase(0, dir_len);
+            list_completions(matches);
+            return true;
+        }
+    }
+
+    // 4. Update the buffer (the caller redraws the line)
+    if (!part_to_add.empty())
+    {
+        cmd_buffer.insert(cursor_pos, part_to_add);
+        cursor_pos += part_to_add.length();
+        last_tab_line = cmd_buffer;
+    }
+    return false;
+}
@@ -0,0 +1,211 @@
+// Library includes
+#include "SHELL.h"
+
+// Line-editor renderer. Instead of echoing every edit with its own flush
+// (and one "\b" per character), it compares what is on screen with the new
+// buffer and sends the difference as ANSI sequences in a single write().
+
+// Cursor moves on the current row: "\b" for one step left, CSI n D / CSI n C
+static void append_move(std::string &out, int from, int to)
+{
+    if (to == from - 1)
+        out += '\b';
+    else if (to < from)
+        out += "\033[" + std::to_string(from - to) + "D";
+    else if (to > from)
+        out += "\033[" + std::to_string(to - from) + "C";
+}
+
+// A pasted or recalled multi-line command keeps its newlines in the
+// buffer; on the one-row line they show as ';', one column each
+static char shown_char(char c)
+{
+    return c == '\n' ? ';' : c;
+}
+
+static void fold_newlines(std::string &s, size_t from)
+{
+    for (size_t i = from; i < s.size(); i++)
+    {
+        if (s[i] == '\n')
+            s[i] = ';';
+    }
+}
+
+void render_line_diff(LineView &view, const std::string &buffer, int cursor_pos, std::string &out)
+{
+    // 1. Skip the part of the line that is already correct on screen. Edits
+    //    happen at the cursor, so in a run of equal characters prefer to
+    //    place the change there rather than at the end of the line.
+    size_t same = 0;
+    size_t limit = std::min(view.shown.size(), buffer.size());
+    limit = std::min(limit, (size_t)std::min(view.cursor, cursor_pos));
+    while (same < limit && view.shown[same] == shown_char(buffer[same]))
+        same++;
+
+    // 2. ...and the part after the change that is still correct
+    size_t tail = 0;
+    while (tail < view.shown.size() - same && tail < buffer.size() - same &&
+           view.shown[view.shown.size() - 1 - tail] == shown_char(buffer[buffer.size() - 1 - tail]))
+        tail++;
+    size_t removed = view.shown.size() - same - tail;
+    size_t added = buffer.size() - same - tail;
+
+    if (removed == 0 && added == 0)
+    {
+        // 3a. Text unchanged: only the cursor moves
+        append_move(out, view.cursor, cursor_pos);
+    }
+    else if (removed == 0 && tail > 0)
+    {
+        // 3b. Pure insertion: open a gap with ICH (CSI n @) and fill it,
+        //     so the rest of the line is not resent
+        append_move(out, view.cursor, (int)same);
+        out += "\033[" + std::to_string(added) + "@";
+        size_t start = out.size();
+        out.append(buffer, same, added);
+        fold_newlines(out, start);
+        append_move(out, (int)(same + added), cursor_pos);
+        view.shown.insert(same, out, start, added);
+    }
+    else if (added == 0 && tail > 0)
+    {
+        // 3c. Pure deletion: DCH (CSI n P) pulls the rest of the line left
+        append_move(out, view.cursor, (int)same);
+        out += "\033[" + std::to_string(removed) + "P";
+        append_move(out, (int)same, cursor_pos);
+        view.shown.erase(same, removed);
+    }
+    else
+    {
+        // 3d. Redraw from the first difference, clear what is left of the
+        //     old line, then put the cursor back where it belongs
+        append_move(out, view.cursor, (int)same);
+        size_t start = out.size();
+        out.append(buffer, same, std::string::npos);
+        fold_newlines(out, start);
+        if (view.shown.size() > buffer.size())
+            out += "\033[K";
+        append_move(out, (int)buffer.size(), cursor_pos);
+
+        view.shown.replace(same, std::string::npos, out, start, buffer.size() - same);
+    }
+    view.cursor = cursor_pos;
+}
+
+bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+void refresh_line(LineView &view, const std::string &buffer, int cursor_pos)
+{
+    static std::string out; // reused so a keystroke does not allocate
+    out.clear();
+    render_line_diff(view, buffer, cursor_pos, out);
+    if (!out.empty())
+        write_all(STDOUT_FILENO, out.data(), out.size());
+}
+
+// Terminal input is read in chunks: one read() takes everything that is
+// available (a fast typist's burst or a whole paste) and the editor only
+// redraws once the chunk has been consumed.
+static const size_t INPUT_CHUNK = 64 * 1024;
+static std::string input_buf; // bytes read but not used yet
+static size_t input_pos = 0;
+
+static bool fill_input()
+{
+    input_buf.resize(INPUT_CHUNK);
+    input_pos = 0;
+    ssize_t n;
+    do
+    {
+        // Child exits are handled while we wait for the user
+        if (!wait_for_input(STDIN_FILENO))
+        {
+            n = -1;
+            break;
+        }
+        n = read(STDIN_FILENO, &input_buf[0], input_buf.size());
+    } while (n < 0 && errno == EINTR);
+    input_buf.resize(n > 0 ? n : 0);
+    return n > 0;
+}
+
+bool input_pending()
+{
+    return input_pos < input_buf.size();
+}
+
+bool read_input_byte(char &c)
+{
+    if (!input_pending() && !fill_input())
+        return false;
+    c = input_buf[input_pos++];
+    return true;
+}
+
+// Collects a bracketed paste (everything up to ESC [201~) in bulk. Line
+// breaks stay in the buffer as newlines, so pasted lines remain separate
+// commands but run only on Enter; tabs become spaces and other control
+// bytes are dropped, so a paste cannot trigger completion either.
+void read_bracketed_paste(std::string &out)
+{
+    static const std::string end_marker = "\033[201~";
+    std::string raw;
+    while (true)
+    {
+        size_t end = input_buf.find(end_marker, input_pos);
+        if (end != std::string::npos)
+        {
+            raw.append(input_buf, input_pos, end - input_pos);
+            input_pos = end + end_marker.size();
+            break;
+        }
+
+        // Keep a possible partial marker at the end of the chunk for the next read
+        size_t keep = std::min(end_marker.size() - 1, input_buf.size() - input_pos);
+        raw.append(input_buf, input_pos, input_buf.size() - input_pos - keep);
+        std::string tail = input_buf.substr(input_buf.size() - keep);
+        if (!fill_input())
+        {
+            raw += tail;
+            break;
+        }
+        input_buf.insert(0, tail);
+    }
+
+    // A copied line usually ends in a newline; drop that one
+    if (!raw.empty() && raw.back() == '\n')
+        raw.pop_back();
+    if (!raw.empty() && raw.back() == '\r')
+        raw.pop_back();
+
+    out.clear();
+    out.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); i++)
+    {
+        char c = raw[i];
+        if (c == '\r' && i + 1 < raw.size() && raw[i + 1] == '\n')
+            continue; // CRLF counts as one line break
+        if (c == '\n' || c == '\r')
+            out += '\n';
+        else if (c == '\t')
+            out += ' ';
+        else if (!iscntrl((unsigned char)c))
+            out += c;
+    }
+}
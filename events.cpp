@@ -0,0 +1,169 @@
+// Library includes
+#include "SHELL.h"
+#include <poll.h>
+#include <sys/signalfd.h>
+
+// SIGCHLD is kept blocked in the shell and delivered through a signalfd,
+// so nothing runs in signal context. Children are reaped from the main
+// loop (while waiting for input and before each prompt), and the job
+// notifications are queued and printed just before the next prompt.
+
+static int sigchld_fd = -1;
+static std::vector<std::string> notifications;
+
+// Exit codes of background jobs that already finished, by the job's pid,
+// so "wait pid" still gets the status of a job reaped before it ran. Only
+// the most recent ones are kept.
+static std::unordered_map<pid_t, int> finished_jobs;
+static std::deque<pid_t> finished_order;
+static const size_t FINISHED_JOBS_KEPT = 4096;
+// ...and by job number, for "wait %N"; a number that is reused is overwritten
+static std::unordered_map<int, int> finished_jids;
+
+void init_child_events()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd < 0)
+    {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void record_child_status(pid_t pid, int status)
+{
+    JobStatus before = RUNNING;
+    if (Job *known = jobs_table.find_by_pid(pid))
+        before = known->status;
+
+    Job *job = jobs_table.record_status(pid, status);
+    if (job == nullptr)
+        return;
+    if (trace_enabled)
+        trace_mark(WIFSTOPPED(status) ? "stopped" : "exit", pid, job->pgid, job->jid, job->command);
+
+    if (WIFSTOPPED(status))
+    {
+        // e.g. a background job that tried to read the terminal
+        if (before != STOPPED)
+            notifications.push_back("[" + std::to_string(job->jid) + "] Stopped\t" + job->command);
+    }
+    else if (job->live == 0)
+    {
+        if (finished_jobs.size() >= FINISHED_JOBS_KEPT)
+        {
+            finished_jobs.erase(finished_order.front());
+            finished_order.pop_front();
+        }
+        if (finished_jobs.insert({job->pid, job->exit_status}).second)
+            finished_order.push_back(job->pid);
+        else
+            finished_jobs[job->pid] = job->exit_status;
+        finished_jids[job->jid] = job->exit_status;
+
+        notifications.push_back(std::string(BLUE) + "[Done] " + job->command + RESET);
+        if (trace_enabled)
+            trace_mark("job done", getpid(), job->pgid, job->jid, job->command);
+        jobs_table.remove(job->jid);
+    }
+}
+
+bool finished_job_status(pid_t pid, int &code)
+{
+    auto it = finished_jobs.find(pid);
+    if (it == finished_jobs.end())
+        return false;
+    code = it->second;
+    return true;
+}
+
+bool finished_jid_status(int jid, int &code)
+{
+    auto it = finished_jids.find(jid);
+    if (it == finished_jids.end())
+        return false;
+    code = it->second;
+    return true;
+}
+
+void reap_children()
+{
+    int status;
+    pid_t pid;
+
+    // Foreground jobs are waited for directly, so anything left here is a
+    // background job (or a pipeline stage of one)
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0)
+        record_child_status(pid, status);
+}
+
+void handle_child_events()
+{
+    // Drain the signalfd; several SIGCHLDs may have been merged into one
+    struct signalfd_siginfo info;
+    while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info))
+        ;
+    reap_children();
+}
+
+// Waits up to timeout_ms (-1: no limit) for a SIGCHLD and drains it, so
+// the caller can reap with WNOHANG. False on timeout or a signal.
+bool wait_child_event(int timeout_ms)
+{
+    struct pollfd pfd = {sigchld_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return false;
+    struct signalfd_siginfo info;
+    while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info))
+        ;
+    return true;
+}
+
+void print_job_notifications()
+{
+    if (!interactive_mode)
+    {
+        notifications.clear();
+        return;
+    }
+    for (const std::string &line : notifications)
+        std::cout << line << std::endl;
+    notifications.clear();
+}
+
+bool wait_for_input(int fd)
+{
+    // poll() skips negative fds: no signalfd, or no prompt worker yet
+    struct pollfd fds[3];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = sigchld_fd;
+    fds[1].events = POLLIN;
+    fds[2].events = POLLIN;
+
+    while (true)
+    {
+        fds[2].fd = prompt_update_fd();
+        if (poll(fds, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (fds[1].revents & POLLIN)
+            handle_child_events();
+        if (fds[2].revents & POLLIN)
+            handle_prompt_update();
+        if (fds[0].revents != 0)
+            return true;
+    }
+}
@@ -0,0 +1,326 @@
+// Library includes
+#include "SHELL.h"
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Filename globbing: *, ?, [...] and ** (any number of directories).
+// A pattern is split at '/' into components, each compiled once into a
+// GlobPattern. Literal components are never read from disk, only checked
+// at the end; wildcard components read their directory with getdents64
+// into a large buffer, reject most names on the pattern's literal prefix
+// and suffix, and only descend into directories that matched. Matching
+// follows every position in the pattern at once (a bit per position), so
+// no pattern backtracks, whatever its stars.
+
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One glob walk: the compiled components and where the paths go
+struct GlobWalk
+{
+    std::vector<GlobPattern> parts;
+    std::vector<bool> recursive; // the component is **
+    bool dirs_only = false;      // the pattern ended in '/'
+    std::vector<std::string> *out;
+};
+
+static const size_t DIR_BUFFER_SIZE = 1024 * 1024;
+
+// Parses the class at pattern[i] ('['); returns the index of its ']' or
+// npos if it isn't closed (then the '[' is an ordinary character)
+static size_t parse_class(const std::string &pattern, size_t i, std::bitset<256> &set)
+{
+    size_t j = i + 1;
+    bool negate = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+    if (negate)
+        j++;
+    for (bool first = true; j < pattern.size(); j++, first = false)
+    {
+        unsigned char c = pattern[j];
+        if (c == ']' && !first)
+            break;
+        if (c == '\\' && j + 1 < pattern.size())
+            c = pattern[++j];
+        unsigned char last = c;
+        if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+        {
+            j += 2;
+            last = pattern[j];
+            if (last == '\\' && j + 1 < pattern.size())
+                last = pattern[++j];
+        }
+        for (int k = c; k <= last; k++)
+            set.set(k);
+    }
+    if (j >= pattern.size())
+        return std::string::npos;
+    if (negate)
+        set.flip();
+    return j;
+}
+
+bool GlobPattern::compile(const std::string &pattern)
+{
+    *this = GlobPattern();
+    std::vector<int> literal_at; // the character at each position, or -1
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        char c = pattern[i];
+        std::bitset<256> set;
+        size_t close;
+        if (c == '*')
+        {
+            if (!star.empty() && star.back())
+                continue; // ** inside a name is just *
+            has_wildcards = true;
+            sets.push_back(set);
+            star.push_back(true);
+            literal_at.push_back(-1);
+            continue;
+        }
+        bool is_literal = false;
+        if (c == '?')
+        {
+            set.set();
+        }
+        else if (c == '[' && (close = parse_class(pattern, i, set)) != std::string::npos)
+        {
+            i = close;
+        }
+        else
+        {
+            if (c == '\\' && i + 1 < pattern.size())
+                c = pattern[++i];
+            set.reset();
+            set.set((unsigned char)c);
+            literal += c;
+            is_literal = true;
+        }
+        has_wildcards = has_wildcards || !is_literal;
+        sets.push_back(set);
+        star.push_back(false);
+        literal_at.push_back(is_literal ? (unsigned char)c : -1);
+        min_length++;
+    }
+
+    // Literal text every match starts and ends with, for a cheap first test
+    size_t m = sets.size();
+    size_t first = 0;
+    while (first < m && literal_at[first] >= 0)
+        prefix += (char)literal_at[first++];
+    any_length = std::find(star.begin(), star.end(), true) != star.end();
+    if (any_length)
+    {
+        size_t last = m;
+        while (last > 0 && literal_at[last - 1] >= 0)
+            last--;
+        for (size_t j = last; j < m; j++)
+            suffix += (char)literal_at[j];
+    }
+    dot_ok = !prefix.empty() && prefix[0] == '.';
+
+    if (m < 64)
+    {
+        masks.assign(256, 0);
+        for (size_t j = 0; j < m; j++)
+        {
+            if (star[j])
+            {
+                star_mask |= 1ULL << j;
+                continue;
+            }
+            for (int c = 0; c < 256; c++)
+            {
+                if (sets[j][c])
+                    masks[c] |= 1ULL << j;
+            }
+        }
+    }
+    return has_wildcards;
+}
+
+bool GlobPattern::match(const char *name, size_t len) const
+{
+    if (len < min_length || (!any_length && len != min_length))
+        return false;
+    if (len > 0 && name[0] == '.' && !dot_ok)
+        return false; // hidden names need an explicit '.'
+    if (memcmp(name, prefix.data(), prefix.size()) != 0 ||
+        memcmp(name + len - suffix.size(), suffix.data(), suffix.size()) != 0)
+        return false;
+
+    // Bit j of state: the first j positions match what was read so far. A
+    // star keeps its bit and also lets the next position start.
+    size_t m = sets.size();
+    if (!masks.empty())
+    {
+        uint64_t state = 1;
+        state |= (state & star_mask) << 1;
+        for (size_t i = 0; i < len && state != 0; i++)
+        {
+            state = ((state & masks[(unsigned char)name[i]]) << 1) | (state & star_mask);
+            state |= (state & star_mask) << 1;
+        }
+        return (state >> m) & 1;
+    }
+
+    // Patterns of 64 positions or more: the same, a byte per position
+    std::vector<char> state(m + 1), next(m + 1);
+    state[0] = 1;
+    for (size_t j = 0; j < m; j++)
+    {
+        if (state[j] && star[j])
+            state[j + 1] = 1;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        std::fill(next.begin(), next.end(), 0);
+        bool alive = false;
+        for (size_t j = 0; j < m; j++)
+        {
+            if (!state[j])
+                continue;
+            if (star[j])
+                next[j] = 1;
+            else if (sets[j][(unsigned char)name[i]])
+                next[j + 1] = 1;
+        }
+        for (size_t j = 0; j < m; j++)
+        {
+            if (next[j] && star[j])
+                next[j + 1] = 1;
+            alive = alive || next[j];
+        }
+        state.swap(next);
+        if (!alive && !state[m])
+            return false;
+    }
+    return state[m];
+}
+
+// Calls visit(dirfd, name, d_type) for each entry of dir except . and ..
+// The buffer is shared, so visit must not scan another directory.
+template <typename F>
+static void scan_dir(const std::string &dir, F visit)
+{
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    static thread_local std::vector<char> buffer;
+    if (buffer.empty())
+        buffer.resize(DIR_BUFFER_SIZE);
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size())) > 0)
+    {
+        for (long offset = 0; offset < n;)
+        {
+            linux_dirent64 *entry = (linux_dirent64 *)(buffer.data() + offset);
+            offset += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            visit(fd, name, entry->d_type);
+        }
+    }
+    close(fd);
+}
+
+// d_type answers this without a stat on most filesystems
+static bool is_directory(int dirfd, const char *name, unsigned char type, bool follow)
+{
+    if (type == DT_DIR)
+        return true;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow))
+        return false;
+    struct stat st;
+    return fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Matches parts[index..] under dir ("" or ending in '/')
+static void walk(GlobWalk &w, const std::string &dir, size_t index)
+{
+    const GlobPattern &part = w.parts[index];
+    bool last = index + 1 == w.parts.size();
+    std::vector<std::string> subdirs; // descended into after the scan
+
+    if (w.recursive[index])
+    {
+        // ** matches no directories too; symlinks are not followed
+        if (!last)
+            walk(w, dir, index + 1);
+        scan_dir(dir, [&](int fd, const char *name, unsigned char type) {
+            if (name[0] == '.')
+                return;
+            bool is_dir = is_directory(fd, name, type, false);
+            if (last && (is_dir || !w.dirs_only))
+                w.out->push_back(dir + name + (w.dirs_only ? "/" : ""));
+            if (is_dir)
+                subdirs.push_back(dir + name + "/");
+        });
+        for (const std::string &sub : subdirs)
+            walk(w, sub, index);
+        return;
+    }
+
+    if (!part.has_wildcards)
+    {
+        std::string path = dir + part.literal;
+        struct stat st;
+        if (!last)
+            walk(w, path + "/", index + 1);
+        else if (w.dirs_only ? stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) : lstat(path.c_str(), &st) == 0)
+            w.out->push_back(path + (w.dirs_only ? "/" : ""));
+        return;
+    }
+
+    scan_dir(dir, [&](int fd, const char *name, unsigned char type) {
+        if (!part.match(name, strlen(name)))
+            return;
+        if (last && !w.dirs_only)
+            w.out->push_back(dir + name);
+        else if (is_directory(fd, name, type, true))
+            (last ? *w.out : subdirs).push_back(dir + name + "/");
+    });
+    for (const std::string &sub : subdirs)
+        walk(w, sub, index + 1);
+}
+
+// Appends the paths matching pattern to matches, sorted. A backslash makes
+// the next character literal. Returns false if nothing matched.
+bool glob_expand(const std::string &pattern, std::vector<std::string> &matches)
+{
+    GlobWalk w;
+    w.out = &matches;
+    w.dirs_only = !pattern.empty() && pattern.back() == '/';
+
+    std::string component;
+    std::istringstream parts(pattern);
+    while (std::getline(parts, component, '/'))
+    {
+        if (component.empty())
+            continue;
+        w.parts.emplace_back();
+        w.recursive.push_back(component == "**");
+        if (component != "**")
+            w.parts.back().compile(component);
+    }
+    // Nothing to expand (like the "[" of a test command)
+    bool wild = false;
+    for (size_t i = 0; i < w.parts.size(); i++)
+        wild = wild || w.recursive[i] || w.parts[i].has_wildcards;
+    if (!wild)
+        return false;
+
+    size_t first = matches.size();
+    walk(w, pattern[0] == '/' ? "/" : "", 0);
+    std::sort(matches.begin() + first, matches.end());
+    matches.erase(std::unique(matches.begin() + first, matches.end()), matches.end());
+    return matches.size() > first;
+}
@@ -0,0 +1,246 @@
+// Library includes
+#include "SHELL.h"
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Command history. Every accepted line is appended to the history file
+// with one O_APPEND write, so several shells can share the file without
+// clobbering each other. On startup the file is only mapped; the newest
+// HISTSIZE entries are pulled out of the mapping (walking back from the
+// end) the first time history is needed. In memory it is a fixed ring.
+// Appends hold a shared flock and trimming an exclusive one.
+
+// A multi-line command is one line in the file, its newlines stored as
+// this byte (the line editor never puts control bytes in a command)
+static const char FILE_NEWLINE = '\x1e';
+
+static const size_t DEFAULT_HISTSIZE = 500;
+static const size_t DEFAULT_HISTFILESIZE = 2000;
+
+static std::string history_path;
+static int history_fd = -1;
+static const char *history_map = nullptr;
+static size_t history_map_size = 0;
+static bool history_loaded = false;
+
+// Ring of the newest entries: ring[(head + i) % ring.size()] is entry i
+static std::vector<std::string> ring;
+static size_t ring_head = 0;
+static size_t ring_count = 0;
+
+static size_t env_limit(const char *name, size_t fallback)
+{
+    const std::string *value = var_get(name);
+    if (value == nullptr || value->empty())
+        return fallback;
+    char *end;
+    long n = strtol(value->c_str(), &end, 10);
+    if (*end != '\0' || n < 0)
+        return fallback;
+    return n;
+}
+
+static void ring_push(const std::string &line)
+{
+    if (ring.empty())
+        return; // HISTSIZE=0
+    if (ring_count < ring.size())
+    {
+        ring[(ring_head + ring_count) % ring.size()] = line;
+        ring_count++;
+    }
+    else
+    {
+        // Full: overwrite the oldest entry
+        ring[ring_head] = line;
+        ring_head = (ring_head + 1) % ring.size();
+    }
+}
+
+// Start of the line that ends just before 'end' in the mapping
+static size_t line_start_before(size_t end)
+{
+    const char *base = history_map;
+    const char *nl = end > 0 ? (const char *)memrchr(base, '\n', end) : nullptr;
+    return nl == nullptr ? 0 : nl - base + 1;
+}
+
+// Cuts the file down to its newest file_limit lines in place. It is not
+// replaced by a new file: other shells keep appending through their fd to
+// this inode. They hold the lock shared for each append, so none of their
+// lines can land while the file is rewritten. The file is read again under
+// the lock, so lines appended since it was mapped are kept.
+static void trim_history_file(size_t file_limit)
+{
+    if (flock(history_fd, LOCK_EX) < 0)
+        return;
+
+    struct stat st;
+    std::string data;
+    if (fstat(history_fd, &st) == 0)
+        data.resize(st.st_size);
+    size_t got = 0;
+    while (got < data.size())
+    {
+        ssize_t n = pread(history_fd, &data[got], data.size() - got, got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    data.resize(got);
+
+    // pos sits on the '\n' that ends the line before the ones seen so far
+    size_t pos = data.size();
+    if (pos > 0 && data[pos - 1] == '\n')
+        pos--;
+    size_t keep_from = 0;
+    for (size_t lines = 0; pos > 0; lines++)
+    {
+        if (lines == file_limit)
+        {
+            keep_from = pos + 1;
+            break;
+        }
+        size_t nl = data.rfind('\n', pos - 1);
+        if (nl == std::string::npos)
+            break;
+        pos = nl;
+    }
+
+    // pwrite() on an O_APPEND fd would append, so drop the flag meanwhile
+    int flags = fcntl(history_fd, F_GETFL);
+    if (keep_from > 0 && flags >= 0 && fcntl(history_fd, F_SETFL, flags & ~O_APPEND) == 0)
+    {
+        size_t keep = data.size() - keep_from;
+        size_t done = 0;
+        while (done < keep)
+        {
+            ssize_t n = pwrite(history_fd, data.data() + keep_from + done, keep - done, done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        if (done == keep && ftruncate(history_fd, keep) < 0)
+        {
+            // The old tail stays; the next trim tries again
+        }
+        fcntl(history_fd, F_SETFL, flags);
+    }
+    flock(history_fd, LOCK_UN);
+}
+
+static void load_history()
+{
+    if (history_loaded)
+        return;
+    history_loaded = true;
+    if (history_map == nullptr)
+        return;
+
+    // Walk back from the end: only the pages holding the newest
+    // HISTFILESIZE lines are touched, however long the file is
+    size_t file_limit = env_limit("HISTFILESIZE", DEFAULT_HISTFILESIZE);
+    std::vector<std::pair<size_t, size_t>> newest; // [start, end) of each line, newest first
+    size_t end = history_map_size;
+    if (end > 0 && history_map[end - 1] == '\n')
+        end--;
+    size_t scanned = 0;
+    while (end > 0 && scanned < file_limit)
+    {
+        size_t start = line_start_before(end);
+        if (newest.size() < ring.size())
+            newest.push_back({start, end});
+        scanned++;
+        end = start > 0 ? start - 1 : 0;
+        if (start == 0)
+            break;
+    }
+
+    for (auto it = newest.rbegin(); it != newest.rend(); ++it)
+    {
+        if (it->second == it->first)
+            continue;
+        std::string line(history_map + it->first, it->second - it->first);
+        std::replace(line.begin(), line.end(), FILE_NEWLINE, '\n');
+        ring_push(line);
+    }
+
+    // Older lines than HISTFILESIZE are still in the file: cut them off
+    if (end > 0)
+        trim_history_file(file_limit);
+
+    munmap((void *)history_map, history_map_size);
+    history_map = nullptr;
+}
+
+void history_init()
+{
+    ring.assign(env_limit("HISTSIZE", DEFAULT_HISTSIZE), std::string());
+
+    const std::string *file = var_get("HISTFILE");
+    if (file != nullptr)
+        history_path = *file;
+    else
+    {
+        const std::string *home = var_get("HOME");
+        if (home == nullptr)
+            return; // history stays in memory only
+        history_path = *home + "/.simple_shell_history";
+    }
+    if (history_path.empty())
+        return;
+
+    history_fd = open(history_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history_fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(history_fd, &st) == 0 && st.st_size > 0)
+    {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, history_fd, 0);
+        if (map != MAP_FAILED)
+        {
+            history_map = (const char *)map;
+            history_map_size = st.st_size;
+        }
+    }
+}
+
+void history_add(const std::string &line)
+{
+    load_history();
+
+    // Skip blank lines and a repeat of the previous command
+    if (line.find_first_not_of(" \t\n") == std::string::npos)
+        return;
+    if (ring_count > 0 && history_at(ring_count - 1) == line)
+        return;
+    ring_push(line);
+
+    if (history_fd >= 0)
+    {
+        // One write per record: O_APPEND keeps concurrent shells' lines whole
+        std::string record = line;
+        std::replace(record.begin(), record.end(), '\n', FILE_NEWLINE);
+        record += '\n';
+        flock(history_fd, LOCK_SH);
+        write_all(history_fd, record.data(), record.size());
+        flock(history_fd, LOCK_UN);
+    }
+}
+
+size_t history_size()
+{
+    load_history();
+    return ring_count;
+}
+
+const std::string &history_at(size_t index)
+{
+    return ring[(ring_head + index) % ring.size()];
+}
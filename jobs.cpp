@@ -0,0 +1,116 @@
+// Library includes
+#include "SHELL.h"
+
+// The job table. Jobs live in a deque slot indexed by jid, with hash
+// indexes from every live member pid and from the process group back to
+// the jid, so reaping a child or finding a job for fg/bg never scans.
+
+JobTable jobs_table;
+
+Job &JobTable::add(pid_t pgid, const std::vector<pid_t> &pids, const std::string &command, JobStatus status)
+{
+    int jid;
+    if (!free_jids.empty())
+    {
+        jid = free_jids.top(); // reuse the lowest free jid, like other shells
+        free_jids.pop();
+    }
+    else
+    {
+        slots.emplace_back();
+        used.push_back(false);
+        jid = slots.size();
+    }
+
+    Job &job = slots[jid - 1];
+    job = Job();
+    job.jid = jid;
+    job.pid = pids.empty() ? pgid : pids.back();
+    job.pgid = pgid;
+    job.command = command;
+    job.status = status;
+    job.pids = pids;
+    job.live = pids.size();
+    clock_gettime(CLOCK_MONOTONIC, &job.start_time);
+
+    for (pid_t pid : pids)
+        by_pid[pid] = jid;
+    by_pgid[pgid] = jid;
+    used[jid - 1] = true;
+    count++;
+    return job;
+}
+
+void JobTable::remove(int jid)
+{
+    Job *job = find(jid);
+    if (job == nullptr)
+        return;
+
+    for (pid_t pid : job->pids)
+    {
+        auto it = by_pid.find(pid);
+        if (it != by_pid.end() && it->second == jid)
+            by_pid.erase(it);
+    }
+    auto it = by_pgid.find(job->pgid);
+    if (it != by_pgid.end() && it->second == jid)
+        by_pgid.erase(it);
+
+    *job = Job(); // drop the strings now rather than when the slot is reused
+    used[jid - 1] = false;
+    free_jids.push(jid);
+    count--;
+}
+
+Job *JobTable::find(int jid)
+{
+    if (jid < 1 || jid > (int)slots.size() || !used[jid - 1])
+        return nullptr;
+    return &slots[jid - 1];
+}
+
+Job *JobTable::find_by_pid(pid_t pid)
+{
+    auto it = by_pid.find(pid);
+    return it == by_pid.end() ? nullptr : &slots[it->second - 1];
+}
+
+Job *JobTable::find_by_pgid(pid_t pgid)
+{
+    auto it = by_pgid.find(pgid);
+    return it == by_pgid.end() ? nullptr : &slots[it->second - 1];
+}
+
+// Returns the job 'pid' belongs to (nullptr if none). A job whose last
+// member has gone has live == 0; removing it is up to the caller.
+Job *JobTable::record_status(pid_t pid, int status)
+{
+    Job *job = find_by_pid(pid);
+    if (job == nullptr)
+        return nullptr;
+
+    if (WIFSTOPPED(status))
+    {
+        job->status = STOPPED;
+        return job;
+    }
+
+    by_pid.erase(pid);
+    job->live--;
+    if (pid == job->pid)
+        job->exit_status = wait_status_to_exit_code(status);
+    return job;
+}
+
+std::vector<Job *> JobTable::list()
+{
+    std::vector<Job *> out;
+    out.reserve(count);
+    for (size_t i = 0; i < slots.size() && out.size() < count; ++i)
+    {
+        if (used[i])
+            out.push_back(&slots[i]);
+    }
+    return out;
+}
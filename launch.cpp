@@ -0,0 +1,426 @@
+// Library includes
+#include "SHELL.h"
+#include <spawn.h>
+#include <unordered_map>
+#include <iomanip>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// posix_spawn can only hand the terminal to the child (tcsetpgrp between
+// setpgid and exec) since glibc 2.35. Older libcs use fork for that case.
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+#endif
+
+LaunchBackend launch_backend = LAUNCH_SPAWN;
+
+// Command path cache (the "hash" builtin): name -> absolute path + hits
+struct HashEntry
+{
+    std::string path;
+    int hits;
+};
+static std::unordered_map<std::string, HashEntry> command_hash;
+static const std::string DEFAULT_PATH = "/usr/local/bin:/usr/bin:/bin"; // when PATH is unset
+
+static bool is_executable_file(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(path.c_str(), X_OK) == 0;
+}
+
+bool resolve_command(const std::string &name, std::string &path)
+{
+    // Names with a slash are used as given, like execvp does
+    if (name.find('/') != std::string::npos)
+    {
+        path = name;
+        return true;
+    }
+
+    auto it = command_hash.find(name);
+    if (it != command_hash.end())
+    {
+        // One access() instead of a PATH walk; re-search if the file moved
+        if (access(it->second.path.c_str(), X_OK) == 0)
+        {
+            it->second.hits++;
+            path = it->second.path;
+            return true;
+        }
+        command_hash.erase(it);
+    }
+
+    const std::string *env_path = var_get("PATH");
+    const std::string &search = env_path != nullptr ? *env_path : DEFAULT_PATH;
+    size_t start = 0;
+    while (start <= search.size())
+    {
+        size_t end = search.find(':', start);
+        if (end == std::string::npos)
+            end = search.size();
+
+        std::string dir = search.substr(start, end - start);
+        if (dir.empty())
+            dir = "."; // an empty PATH entry means the current directory
+        std::string candidate = dir + "/" + name;
+        if (is_executable_file(candidate))
+        {
+            command_hash[name] = HashEntry{candidate, 1};
+            path = candidate;
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+void clear_command_hash()
+{
+    command_hash.clear();
+}
+
+void print_command_hash()
+{
+    if (command_hash.empty())
+    {
+        std::cout << "hash: hash table empty" << std::endl;
+        return;
+    }
+
+    // Sorted by name so the listing is stable
+    std::vector<std::string> names;
+    for (const auto &entry : command_hash)
+        names.push_back(entry.first);
+    std::sort(names.begin(), names.end());
+
+    std::cout << "hits\tcommand" << std::endl;
+    for (const auto &name : names)
+    {
+        const HashEntry &entry = command_hash[name];
+        std::cout << std::setw(4) << entry.hits << "\t" << entry.path << std::endl;
+    }
+}
+
+// Here-documents and here-strings become a readable fd without touching
+// the file system: a pipe that is filled up front when the text fits in
+// the pipe buffer (so the write cannot block), a memfd when it doesn't.
+static int open_here_text(const std::string &text)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == 0)
+    {
+        int capacity = fcntl(pipefd[1], F_GETPIPE_SZ);
+        if (capacity > 0 && text.size() <= (size_t)capacity)
+        {
+            write_all(pipefd[1], text.data(), text.size());
+            close(pipefd[1]);
+            return pipefd[0];
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+
+    int fd = memfd_create("heredoc", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (!write_all(fd, text.data(), text.size()) || lseek(fd, 0, SEEK_SET) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool open_redirections(const std::vector<Redirect> &redirects, std::vector<Redirection> &opened)
+{
+    for (const Redirect &r : redirects)
+    {
+        if (r.type == REDIR_HEREDOC || r.type == REDIR_HERESTRING)
+        {
+            std::string text;
+            if (r.type == REDIR_HERESTRING)
+            {
+                expand_word(r.target, text);
+                text += '\n';
+            }
+            else if (r.expand_heredoc)
+                expand_heredoc(r.heredoc, text);
+            else
+                text = r.heredoc;
+
+            Redirection redir;
+            redir.fd = open_here_text(text);
+            if (redir.fd < 0)
+            {
+                std::cerr << RED << "Error creating here-document" << RESET << std::endl;
+                close_redirections(opened);
+                return false;
+            }
+            redir.target = r.fd;
+            opened.push_back(redir);
+            continue;
+        }
+
+        std::string filename;
+        expand_word(r.target, filename);
+
+        int flags;
+        const char *what;
+        if (r.type == REDIR_APPEND)
+        {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            what = "appending";
+        }
+        else if (r.type == REDIR_OUT)
+        {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+            what = "writing";
+        }
+        else
+        {
+            flags = O_RDONLY;
+            what = "reading";
+        }
+
+        // O_CLOEXEC: the child only sees the file through the dup2 onto target
+        Redirection redir;
+        redir.fd = open(filename.c_str(), flags | O_CLOEXEC, 0644);
+        if (redir.fd < 0)
+        {
+            std::cerr << RED << "Error opening file for " << what << ": " << filename << RESET << std::endl;
+            close_redirections(opened);
+            return false;
+        }
+        redir.target = r.fd;
+        opened.push_back(redir);
+    }
+    return true;
+}
+
+void close_redirections(std::vector<Redirection> &opened)
+{
+    for (Redirection &redir : opened)
+    {
+        if (redir.fd != -1)
+            close(redir.fd);
+    }
+    opened.clear();
+}
+
+// Fork backend, child side: apply the spec by hand, then exec.
+static void exec_child(Argv &args, const std::string &path, const LaunchSpec &spec,
+                       const std::vector<Redirection> &redirs)
+{
+    if (spec.pgid >= 0)
+        setpgid(0, spec.pgid);
+    signal(SIGINT, SIG_DFL);  // Reset Ctrl+C to default
+    signal(SIGTSTP, SIG_DFL); // Reset Ctrl+Z to default
+    sigset_t none; // the shell keeps SIGCHLD blocked, the child must not
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    // Before exec, so whatever the command forks inherits it too
+    if (spec.placement != NULL)
+        apply_placement(*spec.placement, {0}, 0, "job");
+
+    if (spec.foreground)
+    {
+        // Give terminal control to the new foreground job
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+
+    if (spec.null_stdin)
+    {
+        int devNullIn = open("/dev/null", O_RDONLY);
+        if (devNullIn != -1)
+        {
+            dup2(devNullIn, STDIN_FILENO);
+            close(devNullIn);
+        }
+    }
+    if (spec.null_stdout)
+    {
+        int devNullOut = open("/dev/null", O_WRONLY);
+        if (devNullOut != -1)
+        {
+            dup2(devNullOut, STDOUT_FILENO);
+            dup2(devNullOut, STDERR_FILENO);
+            close(devNullOut);
+        }
+    }
+    if (spec.stdin_fd != -1)
+        dup2(spec.stdin_fd, STDIN_FILENO); // read from previous pipe
+    if (spec.stdout_fd != -1)
+        dup2(spec.stdout_fd, STDOUT_FILENO); // write to pipe
+
+    // Before the redirections, which may take over the trace file's fd number
+    if (trace_enabled && !path.empty())
+        trace_mark("exec", getpid(), getpgrp(), 0, path);
+    for (const Redirection &redir : redirs)
+        dup2(redir.fd, redir.target);
+
+    // Compound commands and functions inside a pipeline or a background
+    // job run here, in a subshell without job control. _exit() skips the
+    // shell's atexit handlers, which would write to the child's stdout.
+    if (spec.subshell != NULL || (args[0] != NULL && is_function(args[0])))
+    {
+        interactive_mode = false;
+        int status = spec.subshell != NULL ? execute_compound(*spec.subshell) : call_function(args.data());
+        std::cout << std::flush;
+        _exit(status);
+    }
+
+    if (args[0] == NULL)
+        _exit(EXIT_SUCCESS);
+
+    // Builtins inside a pipeline run here, in the forked child
+    if (handle_builtin(args.data()))
+    {
+        std::cout << std::flush;
+        _exit(builtin_status);
+    }
+
+    execve(path.c_str(), args.data(), spec.envp);
+    std::cerr << RED << "Error executing: " << args[0] << RESET << std::endl;
+    _exit(127);
+}
+
+// Spawn backend: the same setup expressed as spawn attributes and file
+// actions, so the parent never duplicates its address space.
+static pid_t spawn_child(Argv &args, const std::string &path, const LaunchSpec &spec,
+                         const std::vector<Redirection> &redirs)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (spec.pgid >= 0)
+    {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, spec.pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    // Ctrl+C / Ctrl+Z are ignored in the shell; the child gets the defaults
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+
+#ifdef HAVE_SPAWN_TCSETPGRP
+    // Must run before stdin is replaced by a pipe or file
+    if (spec.foreground)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+    if (spec.null_stdin)
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (spec.null_stdout)
+    {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    }
+    if (spec.stdin_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, spec.stdin_fd, STDIN_FILENO);
+    if (spec.stdout_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, spec.stdout_fd, STDOUT_FILENO);
+    for (const Redirection &redir : redirs)
+        posix_spawn_file_actions_adddup2(&actions, redir.fd, redir.target);
+
+    pid_t pid = -1;
+    int err = posix_spawn(&pid, path.c_str(), &actions, &attr, args.data(), spec.envp);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0)
+    {
+        std::cerr << RED << "Error executing: " << args[0] << RESET << std::endl;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t launch_command(Argv &args, const std::vector<Redirect> &redirects, const LaunchSpec &launch_spec,
+                     int &fail_status)
+{
+    // The cached envp of the exported variables unless the caller has its own
+    LaunchSpec spec = launch_spec;
+    if (spec.envp == NULL)
+        spec.envp = var_envp();
+
+    std::vector<Redirection> redirs;
+    if (!open_redirections(redirects, redirs))
+    {
+        fail_status = 1;
+        return -1;
+    }
+
+    // Look the command up here so a typo costs no fork at all
+    std::string path;
+    bool needs_exec = args[0] != NULL && !is_builtin(args[0]) && !is_function(args[0]);
+    if (needs_exec && !resolve_command(args[0], path))
+    {
+        std::cerr << RED << args[0] << ": command not found" << RESET << std::endl;
+        fail_status = 127;
+        close_redirections(redirs);
+        return -1;
+    }
+
+    // Builtins, functions, compound commands and empty commands need a real
+    // fork, and so does a job placement; so does handing over the terminal
+    // when the libc cannot do it from posix_spawn.
+    bool use_fork = launch_backend == LAUNCH_FORK || !needs_exec || spec.placement != NULL;
+#ifndef HAVE_SPAWN_TCSETPGRP
+    use_fork = use_fork || spec.foreground;
+#endif
+
+    long long launch_start = trace_enabled ? trace_now() : 0;
+    pid_t pid;
+    if (use_fork)
+    {
+        pid = fork();
+        if (pid == 0)
+            exec_child(args, path, spec, redirs);
+        if (pid < 0)
+        {
+            std::cerr << RED << "Error forking" << RESET << std::endl;
+            fail_status = 1;
+        }
+        else if (spec.pgid >= 0)
+        {
+            // Also set the group from the parent so it exists before we use it
+            setpgid(pid, spec.pgid == 0 ? pid : spec.pgid);
+        }
+    }
+    else
+    {
+        pid = spawn_child(args, path, spec, redirs);
+        if (pid < 0)
+            fail_status = 127;
+    }
+
+    if (trace_enabled && pid > 0)
+    {
+        // posix_spawn returns once the child has exec'd; a forked child
+        // marks its own exec
+        pid_t group = spec.pgid > 0 ? spec.pgid : (spec.pgid == 0 ? pid : getpgrp());
+        std::string name = args[0] != NULL ? args[0] : "";
+        trace_track_name(pid, std::to_string(pid) + " " + name);
+        trace_span(use_fork ? "fork" : "posix_spawn", launch_start, pid, group, 0, name);
+        if (!use_fork)
+            trace_mark("exec", pid, group, 0, path);
+    }
+
+    close_redirections(redirs);
+    return pid;
+}
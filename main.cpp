@@ -1,19 +1,24 @@
 #include "SHELL.h"
 
-std::vector<Job> jobs_list;
 struct termios orig_termios;
-std::vector<std::string> command_history;
-int history_index = 0;
 
 void disable_raw_mode()
 {
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+    write_all(STDOUT_FILENO, "\033[?2004l", 8); // bracketed paste off
+    tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
 }
 
 void enable_raw_mode()
 {
     tcgetattr(STDIN_FILENO, &orig_termios);
-    atexit(disable_raw_mode); // Ensure we restore terminal on exit
+    // Ensure we restore terminal on exit (registered once: every atexit()
+    // call adds an entry that lives until exit)
+    static bool restore_registered = false;
+    if (!restore_registered)
+    {
+        atexit(disable_raw_mode);
+        restore_registered = true;
+    }
 
     struct termios raw = orig_termios;
     // Disable:
@@ -21,77 +26,47 @@ void enable_raw_mode()
     // ICANON: Turn off canonical mode (read byte-by-byte, not line-by-line)
     raw.c_lflag &= ~(ECHO | ICANON);
 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
-}
-//
+    // TCSANOW rather than TCSAFLUSH so keys typed ahead are not thrown away
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
 
-int get_next_jid()
-{
-  int max_jid = 0;
-  for (const auto &job : jobs_list)
-  {
-    if (job.jid > max_jid)
-    {
-      max_jid = job.jid;
-    }
-  }
-  return max_jid + 1;
+    // Ask the terminal to wrap pastes in ESC [200~ ... ESC [201~
+    write_all(STDOUT_FILENO, "\033[?2004h", 8);
 }
+//
 
-void handle_sigchld(int sig)
-{
-  (void)sig; // Suppress unused parameter warning
-  int status;
-  pid_t pid;
-
-  // --- REPLACE YOUR OLD FUNCTION WITH THIS ---
-  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
-  {
-    // A child process finished
-    std::string cmd_str = "Unknown";
-    bool found = false;
-
-    // Find the job in our list
-    for (auto it = jobs_list.begin(); it != jobs_list.end(); ++it)
-    {
-      if (it->pid == pid)
-      {
-        cmd_str = it->command;
-        jobs_list.erase(it); // Remove from list
-        found = true;
-        break;
-      }
-    }
-
-    if (found)
-    {
-      // Print the "Done" message with the command name
-      std::cout << std::endl
-                << BLUE << "[" << "Done" << "] " << cmd_str << RESET << std::endl;
-    }
-  }
-}
+static bool input_eof = false; // Ctrl+D on an empty continuation line
 
-std::string get_input(void)
+// Reads one line with the editor. A continuation line (the rest of an
+// open quote, a pipe or a here-document) gets a "> " prompt instead.
+std::string get_input(bool continuation)
 {
-    std::string cwd(1024, '\0');
-    if (NULL == getcwd(cwd.data(), cwd.size()))
-    {
-        std::cerr << RED << "Error getting current working directory" << RESET
-                  << std::endl;
-    }
-    std::cout << GREEN << cwd << " $ " << RESET << std::flush; // Use flush instead of endl
+    if (continuation)
+        std::cout << "> " << std::flush;
+    else
+        print_prompt(true);
 
     enable_raw_mode();
 
     std::string cmd_buffer;
     int cursor_pos = 0;
+    LineView view; // what is on screen after the prompt
+    // A prompt segment that finishes late redraws the prompt and this line
+    if (!continuation)
+        prompt_attach_line(&view, &cmd_buffer, &cursor_pos);
+    size_t history_index = history_size(); // one past the newest entry
     char c;
-    while (read(STDIN_FILENO, &c, 1) == 1)
+    while (true)
     {
+        // Redraw once everything read so far has been handled
+        if (!input_pending())
+            refresh_line(view, cmd_buffer, cursor_pos);
+        if (!read_input_byte(c))
+            break;
+
         // Check for Enter key (\r or \n)
         if (c == '\r' || c == '\n')
         {
+            refresh_line(view, cmd_buffer, cursor_pos);
             std::cout << std::endl; // Print a real newline to move to the next line
             break;
         }
@@ -100,12 +75,19 @@ std::string get_input(void)
         {
             std::cout << "^C" << std::endl;
             cmd_buffer.clear(); // Clear whatever was typed
+            prompt_attach_line(NULL, NULL, NULL);
             disable_raw_mode(); // Must disable raw mode before returning!
             return "";          // Return empty string to show new prompt
         }
         // Check for Ctrl+D (byte value 4, End of Transmission)
         else if (c == 4)
         {
+            if (cmd_buffer.empty() && continuation)
+            {
+                std::cout << std::endl;
+                input_eof = true;
+                break;
+            }
             if (cmd_buffer.empty())
             {
                 std::cout << "exit" << std::endl;
@@ -116,98 +98,79 @@ std::string get_input(void)
         // Check for Tab Key
         else if (c == 9) // 9 is the byte for Tab
         {
-            // --- REPLACE THIS ---
-            // std::cout << "[TAB]" << std::flush;
-            // --- WITH THIS ---
-            handle_tab_completion(cmd_buffer, cursor_pos);
+            // A second Tab lists the matches below the line: start a new prompt
+            refresh_line(view, cmd_buffer, cursor_pos);
+            if (handle_tab_completion(cmd_buffer, cursor_pos))
+            {
+                if (continuation)
+                    std::cout << "> " << std::flush;
+                else
+                    print_prompt(false);
+                view = LineView();
+            }
         }
         else if (c == 127 || c == 8)
         {
-           if (cursor_pos > 0)
+            if (cursor_pos > 0)
             {
                 // Remove char BEFORE cursor
                 cmd_buffer.erase(cursor_pos - 1, 1);
                 cursor_pos--;
-                
-                // Move cursor back one space
-                std::cout << "\b" << std::flush;
-                
-                // Re-print the rest of the line from the new cursor position
-                std::cout << cmd_buffer.substr(cursor_pos) << " " << std::flush;
-                
-                // Move cursor back to its correct position
-                // We printed (len - pos) characters, plus one space.
-                for (int i = cursor_pos; i < (int)cmd_buffer.length() + 1; i++)
-                {
-                     std::cout << "\b";
-                }
-                std::cout << std::flush;
             }
         }
-        // ... inside while(read(...)) ...
-
         // Check for Escape Sequence (Arrow Keys start with \x1b)
         else if (c == 27)
         {
             char seq[2];
             // Try to read the next 2 bytes
-            if (read(STDIN_FILENO, &seq[0], 1) == 1 &&
-                read(STDIN_FILENO, &seq[1], 1) == 1)
+            if (read_input_byte(seq[0]) && read_input_byte(seq[1]))
             {
-                if (seq[0] == '[')
+                // ESC [ 200 ~ starts a bracketed paste: insert it as one block
+                std::string param;
+                while (seq[0] == '[' && isdigit(seq[1]) && param.size() < 4)
+                {
+                    param += seq[1];
+                    if (!read_input_byte(seq[1]))
+                        break;
+                }
+                if (param == "200" && seq[1] == '~')
+                {
+                    std::string pasted;
+                    read_bracketed_paste(pasted);
+                    cmd_buffer.insert(cursor_pos, pasted);
+                    cursor_pos += pasted.length();
+                }
+                else if (seq[0] == '[' && param.empty())
                 {
                     switch (seq[1])
                     {
-                       case 'A': // Up Arrow
+                        case 'A': // Up Arrow
                             if (history_index > 0)
                             {
                                 history_index--;
-                                // 1. Erase current line from screen
-                                while (cmd_buffer.length() > 0)
-                                {
-                                    std::cout << "\b \b" << std::flush;
-                                    cmd_buffer.pop_back();
-                                }
-                                // 2. Load command from history
-                                cmd_buffer = command_history[history_index];
-                                // 3. Print it to screen
-                                std::cout << cmd_buffer << std::flush;
-
+                                cmd_buffer = history_at(history_index);
                                 cursor_pos = cmd_buffer.length();
                             }
                             break;
                         case 'B': // Down Arrow
-                            if (history_index < (int)command_history.size())
+                            if (history_index < history_size())
                             {
                                 history_index++;
-                                // 1. Erase current line
-                                while (cmd_buffer.length() > 0)
-                                {
-                                    std::cout << "\b \b" << std::flush;
-                                    cmd_buffer.pop_back();
-                                }
-                                // 2. Load command (or empty if at the end)
-                                if (history_index < (int)command_history.size())
-                                {
-                                    cmd_buffer = command_history[history_index];
-                                    std::cout << cmd_buffer << std::flush;
-                                }
+                                // Load command (or empty if at the end)
+                                if (history_index < history_size())
+                                    cmd_buffer = history_at(history_index);
+                                else
+                                    cmd_buffer.clear();
                                 cursor_pos = cmd_buffer.length();
                             }
                             break;
-                       case 'C': // Right Arrow
+                        case 'C': // Right Arrow
                             if (cursor_pos < (int)cmd_buffer.length())
-                            {
                                 cursor_pos++;
-                                std::cout << "\033[C" << std::flush; // ANSI escape to move right
-                            }
                             break;
                         case 'D': // Left Arrow
                             if (cursor_pos > 0)
-                            {
                                 cursor_pos--;
-                                std::cout << "\b" << std::flush; // Move cursor back
-                            }
                             break;
                     }
                 }
@@ -216,32 +179,11 @@ std::string get_input(void)
         // Handle normal printable characters
         else if (!iscntrl(c)) 
         {
-            if (cursor_pos == (int)cmd_buffer.length())
-            {
-                // Normal append at the end
-                cmd_buffer += c;
-                cursor_pos++;
-                std::cout << c << std::flush;
-            }
-            else
-            {
-                // Insert in the middle
-                cmd_buffer.insert(cursor_pos, 1, c);
-                
-                // We have to reprint the WHOLE rest of the line
-                std::cout << cmd_buffer.substr(cursor_pos) << std::flush;
-                
-                // Now we have to move the cursor BACK to where it should be
-                // because printing pushed it all the way to the end.
-                cursor_pos++;
-                for (int i = cursor_pos; i < (int)cmd_buffer.length(); i++)
-                {
-                     std::cout << "\b";
-                }
-                std::cout << std::flush;
-            }
+            cmd_buffer.insert(cursor_pos, 1, c);
+            cursor_pos++;
         }
     }
+    prompt_attach_line(NULL, NULL, NULL);
     disable_raw_mode();
     return cmd_buffer;
 }
@@ -259,7 +201,7 @@ void shell_launch(std::vector<char *> args)
       std::cerr << RED << "Error executing command: " << args[0] << RESET
                 << std::endl;
     }
-    exit(EXIT_FAILURE);
+    _exit(EXIT_FAILURE);
   }
   else
   {
@@ -267,13 +209,161 @@ void shell_launch(std::vector<char *> args)
   }
 }
 
-int main(void)
+
+// Batch mode: read commands from fd in large chunks and run them line by
+// line. No prompt, no raw mode and no per-byte read() calls.
+int run_batch(int fd)
+{
+  static const size_t BATCH_CHUNK = 64 * 1024;
+  std::string buffer;
+  std::vector<char> chunk(BATCH_CHUNK);
+  size_t line_start = 0;
+  std::string pending; // lines of a command that is not finished yet
+  ParseWait wait;      // what pending still needs
+
+  while (true)
+  {
+    long long read_start = trace_enabled ? trace_now() : 0;
+    ssize_t n = read(fd, chunk.data(), chunk.size());
+    if (trace_enabled)
+      trace_span("read input", read_start, getpid(), getpgrp(), 0, "");
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("read");
+      break;
+    }
+
+    if (n > 0)
+      buffer.append(chunk.data(), n);
+
+    // Run every complete line in the buffer (the last line may have no '\n')
+    size_t nl;
+    while ((nl = buffer.find('\n', line_start)) != std::string::npos ||
+           (n == 0 && line_start < buffer.size()))
+    {
+      if (nl == std::string::npos)
+        nl = buffer.size();
+
+      size_t line = pending.size();
+      pending.append(buffer, line_start, nl - line_start);
+      pending += '\n';
+      line_start = nl + 1;
+
+      // Open quotes or a trailing '|' / '&&' continue on the next line.
+      // Parse again only once a line could finish it: parsing the whole
+      // of a long here-document or loop body per line is quadratic.
+      if (line > 0 && !line_may_finish(wait, pending.substr(line, pending.size() - line - 1)))
+        continue;
+      Node tree;
+      std::string error;
+      long long parse_start = trace_enabled ? trace_now() : 0;
+      ParseStatus parsed = parse_command_line(pending, tree, error, &wait);
+      if (trace_enabled)
+        trace_span("parse", parse_start, getpid(), getpgrp(), 0, pending);
+      if (parsed == PARSE_INCOMPLETE)
+        continue;
+      if (parsed == PARSE_OK)
+        execute_list(tree);
+      else
+      {
+        std::cerr << RED << error << RESET << std::endl;
+        last_status = 2;
+      }
+      pending.clear();
+      reap_children(); // don't let finished background jobs pile up as zombies
+    }
+
+    // Drop the lines we already ran so the buffer stays small
+    if (line_start > 0)
+    {
+      buffer.erase(0, std::min(line_start, buffer.size()));
+      line_start = 0;
+    }
+
+    if (n == 0)
+      break; // EOF
+  }
+
+  if (!pending.empty())
+  {
+    std::cerr << RED << "syntax error: unexpected end of file" << RESET << std::endl;
+    last_status = 2;
+  }
+  return last_status;
+}
+
+void print_usage(const char *prog)
+{
+  std::cerr << "Usage: " << prog << " [-c command | script-file]" << std::endl;
+}
+
+int main(int argc, char *argv[])
 {
   std::string input;
+
+  // Pick the mode: "-c string", "script-file" or commands piped on stdin
+  // all run without the line editor or job control.
+  const char *command_string = NULL;
+  const char *script_file = NULL;
+  if (argc > 1)
+  {
+    if (strcmp(argv[1], "-c") == 0)
+    {
+      if (argc < 3)
+      {
+        print_usage(argv[0]);
+        return 2;
+      }
+      command_string = argv[2];
+    }
+    else
+    {
+      script_file = argv[1];
+      positional_args.assign(argv + 2, argv + argc); // $1... of the script
+    }
+  }
+  interactive_mode = command_string == NULL && script_file == NULL && isatty(STDIN_FILENO);
+
+  const char *backend = getenv("SHELL_LAUNCH");
+  if (backend != NULL && strcmp(backend, "fork") == 0)
+    launch_backend = LAUNCH_FORK;
+
+  // Child exits arrive on a signalfd that the main loop reads
+  init_child_events();
+
+  // $SIMPLE_SHELL_TRACE=file writes a trace of everything the shell runs
+  const char *trace_file = getenv("SIMPLE_SHELL_TRACE");
+  if (trace_file != NULL && *trace_file != '\0')
+    trace_start(trace_file);
+  atexit(trace_stop);
+
+  if (!interactive_mode)
+  {
+    if (command_string != NULL)
+      return run_command_line(command_string);
+
+    int fd = STDIN_FILENO;
+    if (script_file != NULL)
+    {
+      fd = open(script_file, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+      {
+        std::cerr << RED << "Error opening script: " << script_file << RESET << std::endl;
+        return 127;
+      }
+    }
+    int status = run_batch(fd);
+    if (fd != STDIN_FILENO)
+      close(fd);
+    return status;
+  }
+
   print_banner_R();
 
-  // Put shell in its own process group
-  if (setpgid(getpid(), getpid()) < 0)
+  // Put shell in its own process group (a session leader already is)
+  if (getpgrp() != getpid() && setpgid(getpid(), getpid()) < 0)
   {
     perror("setpgid");
     exit(EXIT_FAILURE);
@@ -285,6 +375,11 @@ int main(void)
     exit(EXIT_FAILURE);
   }
 
+  // Map the history file; entries are read on first use
+  history_init();
+  // Index $PATH for command completion in the background
+  start_command_index();
+
   // Ignore Ctrl+C in the main shell
   signal(SIGINT, SIG_IGN);
   // Ignore terminal write signals (for background processes)
@@ -292,184 +387,53 @@ int main(void)
   // Ignore Ctrl+Z (SIGTSTP) in the parent shell
   signal(SIGTSTP, SIG_IGN);
 
-  struct sigaction sa;
-  sa.sa_handler = &handle_sigchld; // Set the handler function
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP; // Restart syscalls, don't stop for SIGCHLD
-  if (sigaction(SIGCHLD, &sa, 0) == -1)
-  {
-    perror("sigaction");
-    exit(EXIT_FAILURE);
-  }
-
   while (1)
   {
-    input = get_input();
+    // Reap finished background jobs and report them before the prompt
+    reap_children();
+    print_job_notifications();
+
+    long long read_start = trace_enabled ? trace_now() : 0;
+    input = get_input(false);
+    if (trace_enabled)
+      trace_span("read input", read_start, getpid(), getpgrp(), 0, input);
     if (input.empty())
       continue;
 
-    command_history.push_back(input);
-    history_index = command_history.size();
-
-    // Outer loop: splits by "&&"
-    std::vector<std::string> logical_commands = split_commands(input);
-    bool success = true;
-
-    for (auto &cmd_group : logical_commands)
+    // An open quote, a trailing | or && or a here-document body goes on
+    // over the next lines
+    Node tree;
+    std::string error;
+    input_eof = false;
+    long long parse_start = trace_enabled ? trace_now() : 0;
+    ParseStatus parsed;
+    while ((parsed = parse_command_line(input, tree, error)) == PARSE_INCOMPLETE && !input_eof)
     {
-      if (!success)
-        break; // Stop processing '&&' chain if a command fails
-
-      // Check if the whole '&&' group ends with &
-      bool group_has_trailing_amp = false;
-      std::string trimmed_group = trim(cmd_group);
-      if (!trimmed_group.empty() && trimmed_group.back() == '&')
-      {
-        group_has_trailing_amp = true;
-      }
-
-      // Inner loop: splits the group by "&"
-      std::vector<std::string> bg_commands = split_by_ampersand(cmd_group);
-
-      for (size_t i = 0; i < bg_commands.size(); ++i)
-      {
-        std::string cmd = bg_commands[i];
-        if (cmd.empty())
-          continue;
-
-        bool is_background = true; // Assume background since it was split by '&'
-        if (i == bg_commands.size() - 1 && !group_has_trailing_amp)
-        {
-          is_background = false;
-        }
-
-        // --- This is your original execution logic ---
-        if (cmd.find('|') != std::string::npos)
-        {
-          execute_pipes(cmd, is_background);
-          continue;
-        }
-
-        std::vector<char *> args = tokenize_input(cmd);
-
-        if (handle_builtin(args))
-        {
-          for (char *arg : args)
-          {
-            delete[] arg;
-          }
-          continue;
-        }
-
-        pid_t pid = fork();
-
-        if (pid < 0) // failure in forking
-        {
-          std::cerr << RED << "Error forking" << RESET << std::endl;
-          success = false;
-          break; // Exit inner loop
-        }
-
-        if (pid == 0) // --- CHILD PROCESS ---
-        {
-          setpgid(0, 0);            // this will put the child in its own process group
-          signal(SIGINT, SIG_DFL);  // Reset Ctrl+C to default
-          signal(SIGTSTP, SIG_DFL); // Reset Ctrl+Z to default
-          if (!is_background)
-          {
-            // Give terminal control to the new foreground job
-            tcsetpgrp(STDIN_FILENO, getpid());
-          }
-          if (is_background)
-          {
-            // Redirect stdin, stdout, stderr to /dev/null
-            int devNullIn = open("/dev/null", O_RDONLY);
-            int devNullOut = open("/dev/null", O_WRONLY);
-            if (devNullIn != -1)
-            {
-              dup2(devNullIn, STDIN_FILENO);
-              close(devNullIn);
-            }
-            if (devNullOut != -1)
-            {
-              dup2(devNullOut, STDOUT_FILENO);
-              dup2(devNullOut, STDERR_FILENO);
-              close(devNullOut);
-            }
-          }
-
-          handle_redirection(cmd);
-
-          std::vector<char *> child_args = tokenize_input(cmd);
-          if (child_args.empty() || child_args[0] == NULL)
-          {
-            for (char *arg : child_args)
-              delete[] arg;
-            exit(EXIT_SUCCESS);
-          }
-          if (execvp(child_args[0], child_args.data()) == -1)
-          {
-            std::cerr << RED << "Error executing: " << child_args[0] << RESET
-                      << std::endl;
-            for (char *arg : child_args)
-            {
-              delete[] arg;
-            }
-            exit(EXIT_FAILURE);
-          }
-        }
-        else // --- PARENT PROCESS ---
-        {
-          if (is_background)
-          {
-            Job new_job;
-            new_job.pid = pid;
-            new_job.jid = get_next_jid();
-            new_job.command = cmd; // The command string
-            new_job.status = RUNNING;
-            jobs_list.push_back(new_job);
-
-            // Print [jid] pid
-            std::cout << BLUE << "[" << new_job.jid << "] " << new_job.pid << RESET << std::endl;
-            success = true; // Allow '&&' chain to continue
-          }
-          else
-          {
-            // Foreground job: Wait for it to finish
-            int status;
-            waitpid(pid, &status, WUNTRACED); // <-- Add WUNTRACED
-            success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
-
-            // Take back terminal control
-            tcsetpgrp(STDIN_FILENO, getpid());
-
-            if (WIFSTOPPED(status))
-            {
-              // The job was stopped (Ctrl+Z)
-              std::cout << std::endl;
-              Job new_job;
-              new_job.pid = pid;
-              new_job.jid = get_next_jid();
-              new_job.command = cmd;
-              new_job.status = STOPPED; // <-- Set status
-              jobs_list.push_back(new_job);
-              std::cout << "[" << new_job.jid << "] Stopped\t" << new_job.command << std::endl;
-            }
-          }
-          for (char *arg : args)
-          {
-            delete[] arg;
-          }
-        }
+      input += "\n" + get_input(true);
+      if (trace_enabled)
+        parse_start = trace_now();
+    }
+    history_add(input); // with its continuation lines, as one entry
+    if (trace_enabled)
+      trace_span("parse", parse_start, getpid(), getpgrp(), 0, input);
+    if (input_eof)
+    {
+      std::cerr << RED << "syntax error: unexpected end of file" << RESET << std::endl;
+      last_status = 2;
+      continue;
+    }
 
-        if (!is_background && !success)
-        {
-          // The foreground job failed, so stop processing
-          // the rest of this '&&' group.
-          break;
-        }
-      } // End of inner 'for' loop (bg_commands)
-    } // End of outer 'for' loop (logical_commands)
+    // Run the tree just built rather than parsing the line again
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    if (parsed == PARSE_OK)
+      execute_list(tree);
+    else
+    {
+      std::cerr << RED << error << RESET << std::endl;
+      last_status = 2;
+    }
+    prompt_command_finished(seconds_since(started));
   } // End of while(1)
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
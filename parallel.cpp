@@ -0,0 +1,234 @@
+// Library includes
+#include "SHELL.h"
+#include <poll.h>
+
+// The "parallel" builtin:
+//
+//   parallel [-j N] [command...] [::: arg...]
+//
+// Runs one job per argument after ":::" (or per line of stdin), at most N
+// at a time (default: number of cores). With a command, "{}" in it is
+// replaced by the argument, or the argument is appended; without one each
+// argument is a whole command line. Every job runs in a forked subshell
+// with stdout and stderr on a pipe; its output is printed in one piece
+// when it finishes, so jobs never interleave. Workers are entered in the
+// job table while they run.
+
+struct ParallelJob
+{
+    std::string command;
+    pid_t pid = -1;
+    int jid = 0;
+    int out_fd = -1; // read end of the job's stdout/stderr pipe
+    std::string output;
+};
+
+static std::string make_command(const std::string &tmpl, const std::string &arg)
+{
+    if (tmpl.empty())
+        return arg;
+    size_t pos = tmpl.find("{}");
+    if (pos == std::string::npos)
+        return tmpl + " " + arg;
+
+    std::string command;
+    size_t start = 0;
+    while (pos != std::string::npos)
+    {
+        command.append(tmpl, start, pos - start);
+        command += arg;
+        start = pos + 2;
+        pos = tmpl.find("{}", start);
+    }
+    command.append(tmpl, start, std::string::npos);
+    return command;
+}
+
+static void read_lines(int fd, std::vector<std::string> &lines)
+{
+    std::string data;
+    char buf[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        data.append(buf, n);
+    }
+
+    size_t start = 0;
+    while (start < data.size())
+    {
+        size_t nl = data.find('\n', start);
+        if (nl == std::string::npos)
+            nl = data.size();
+        std::string line = trim(data.substr(start, nl - start));
+        if (!line.empty())
+            lines.push_back(line);
+        start = nl + 1;
+    }
+}
+
+static bool start_job(ParallelJob &job)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        perror("pipe");
+        return false;
+    }
+
+    std::cout << std::flush;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Subshell: same group as the shell, so Ctrl+C reaches every job
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        interactive_mode = false;
+
+        int devNullIn = open("/dev/null", O_RDONLY);
+        if (devNullIn != -1)
+        {
+            dup2(devNullIn, STDIN_FILENO);
+            close(devNullIn);
+        }
+        dup2(pipefd[1], STDOUT_FILENO);
+        dup2(pipefd[1], STDERR_FILENO);
+
+        // _exit(): the shell's atexit handlers and static destructors are
+        // not the child's to run
+        int status = run_command_line(job.command);
+        std::cout << std::flush;
+        _exit(status);
+    }
+    close(pipefd[1]);
+    if (pid < 0)
+    {
+        std::cerr << RED << "Error forking" << RESET << std::endl;
+        close(pipefd[0]);
+        return false;
+    }
+
+    job.pid = pid;
+    job.out_fd = pipefd[0];
+    job.jid = jobs_table.add(getpgrp(), {pid}, job.command, RUNNING).jid; // shares the shell's group
+    return true;
+}
+
+void run_parallel(char **args)
+{
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    std::string tmpl;
+    std::vector<std::string> inputs;
+    bool have_list = false;
+
+    size_t i = 1;
+    if (args[i] != NULL && strcmp(args[i], "-j") == 0)
+    {
+        if (args[i + 1] == NULL || std::atoi(args[i + 1]) <= 0)
+        {
+            std::cerr << RED << "parallel: -j expects a positive number" << RESET << std::endl;
+            builtin_status = 2;
+            return;
+        }
+        max_jobs = std::atoi(args[i + 1]);
+        i += 2;
+    }
+    for (; args[i] != NULL; ++i)
+    {
+        if (have_list)
+            inputs.push_back(args[i]);
+        else if (strcmp(args[i], ":::") == 0)
+            have_list = true;
+        else
+            tmpl += (tmpl.empty() ? "" : " ") + std::string(args[i]);
+    }
+    if (!have_list)
+        read_lines(STDIN_FILENO, inputs);
+    if (max_jobs < 1)
+        max_jobs = 1;
+
+    std::vector<ParallelJob> jobs(inputs.size());
+    for (size_t j = 0; j < inputs.size(); ++j)
+        jobs[j].command = make_command(tmpl, inputs[j]);
+
+    size_t next = 0;
+    std::vector<size_t> running; // indexes into jobs
+    std::vector<std::pair<int, std::string>> failures; // exit code, command
+    std::vector<struct pollfd> fds;
+    char buf[64 * 1024];
+
+    while (next < jobs.size() || !running.empty())
+    {
+        // Keep max_jobs workers busy
+        while ((long)running.size() < max_jobs && next < jobs.size())
+        {
+            if (start_job(jobs[next]))
+                running.push_back(next);
+            else
+                failures.push_back({1, jobs[next].command});
+            next++;
+        }
+        if (running.empty())
+            continue;
+
+        fds.clear();
+        for (size_t idx : running)
+            fds.push_back({jobs[idx].out_fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        // Collect output; a job is done once its pipe hits EOF
+        for (size_t k = 0; k < fds.size(); ++k)
+        {
+            if (fds[k].revents == 0)
+                continue;
+            ParallelJob &job = jobs[running[k]];
+            ssize_t n = read(job.out_fd, buf, sizeof(buf));
+            if (n > 0)
+            {
+                job.output.append(buf, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            close(job.out_fd);
+            job.out_fd = -1;
+            int status = 0;
+            while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            jobs_table.remove(job.jid);
+
+            // The whole output of one job in a single write
+            write_all(STDOUT_FILENO, job.output.data(), job.output.size());
+            job.output.clear();
+            job.output.shrink_to_fit();
+
+            int code = wait_status_to_exit_code(status);
+            if (code != 0)
+                failures.push_back({code, job.command});
+        }
+        running.erase(std::remove_if(running.begin(), running.end(),
+                                     [&](size_t idx) { return jobs[idx].out_fd == -1; }),
+                      running.end());
+    }
+
+    if (!failures.empty())
+    {
+        std::cerr << RED << "parallel: " << failures.size() << " of " << jobs.size() << " jobs failed" << RESET << std::endl;
+        for (const auto &failure : failures)
+            std::cerr << RED << "  exit " << failure.first << ": " << failure.second << RESET << std::endl;
+        builtin_status = std::min<int>(failures.size(), 101); // like GNU parallel
+    }
+}
@@ -0,0 +1,1110 @@
+// Library includes
+#include "SHELL.h"
+
+// Single-pass lexer + recursive-descent parser. Tokens are produced on
+// demand while the tree is built, so every byte of the line is scanned
+// once and no intermediate strings are split off and re-scanned.
+
+enum TokenType
+{
+    TOK_WORD,
+    TOK_PIPE,    // |
+    TOK_OR,      // ||
+    TOK_AMP,     // &
+    TOK_AND,     // &&
+    TOK_SEMI,    // ;
+    TOK_DSEMI,   // ;; (ends a case item)
+    TOK_LPAREN,  // (
+    TOK_RPAREN,  // )
+    TOK_NEWLINE,
+    TOK_LESS,    // <
+    TOK_GREAT,   // >
+    TOK_DGREAT,  // >>
+    TOK_DLESS,   // <<
+    TOK_DLESSDASH, // <<-
+    TOK_TLESS,   // <<<
+    TOK_EOF
+};
+
+struct Token
+{
+    TokenType type;
+    std::string text; // raw word text, quotes kept
+    int io_number;    // "2>file": fd in front of a redirection, -1 if none
+    size_t start;     // byte range in the source
+    size_t end;
+};
+
+struct Parser
+{
+    const std::string &src;
+    size_t pos;
+    Token tok;
+    size_t last_end; // end of the last token consumed
+    ParseStatus status;
+    std::string error;
+    size_t heredoc_pos; // where the next here-document body starts (npos: after this line)
+    std::vector<const char *> open; // closing words of the compound commands being parsed
+    ParseWait wait;                 // filled in when the input runs out
+};
+
+static bool is_meta(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '|' || c == '&' || c == ';' || c == '<' || c == '>' ||
+           c == '(' || c == ')';
+}
+
+static void fail(Parser &p, ParseStatus status, const std::string &message)
+{
+    if (p.status == PARSE_OK)
+    {
+        p.status = status;
+        p.error = message;
+        if (status == PARSE_INCOMPLETE)
+            p.wait.closers.assign(p.open.begin(), p.open.end());
+    }
+    p.tok.type = TOK_EOF;
+}
+
+// Out of input inside a word: a quote needs a line with that quote, the
+// rest (\, ${, $(, `) just take the next line
+static void fail_in_word(Parser &p, char quote, const std::string &message)
+{
+    bool first = p.status == PARSE_OK;
+    fail(p, PARSE_INCOMPLETE, message);
+    if (first)
+    {
+        p.wait.closers.clear();
+        p.wait.quote = quote;
+    }
+}
+
+// Index of the '`' closing the backquote at open, or npos
+size_t find_backquote_end(const std::string &s, size_t open)
+{
+    for (size_t i = open + 1; i < s.size(); i++)
+    {
+        if (s[i] == '\\')
+            i++;
+        else if (s[i] == '`')
+            return i;
+    }
+    return std::string::npos;
+}
+
+// Index of the ')' closing the "$(" whose '(' is at open, or npos. Quotes,
+// escapes and nested substitutions inside are skipped as units.
+size_t find_substitution_end(const std::string &s, size_t open)
+{
+    int depth = 1;
+    for (size_t i = open + 1; i < s.size(); i++)
+    {
+        char c = s[i];
+        if (c == '\\')
+        {
+            i++;
+        }
+        else if (c == '\'')
+        {
+            i = s.find('\'', i + 1);
+            if (i == std::string::npos)
+                return i;
+        }
+        else if (c == '`')
+        {
+            i = find_backquote_end(s, i);
+            if (i == std::string::npos)
+                return i;
+        }
+        else if (c == '"')
+        {
+            for (i++; i < s.size() && s[i] != '"'; i++)
+            {
+                if (s[i] == '\\')
+                    i++;
+                else if (s[i] == '$' && i + 1 < s.size() && s[i + 1] == '(')
+                {
+                    i = find_substitution_end(s, i + 1);
+                    if (i == std::string::npos)
+                        return i;
+                }
+            }
+            if (i >= s.size())
+                return std::string::npos;
+        }
+        else if (c == '(')
+        {
+            depth++;
+        }
+        else if (c == ')' && --depth == 0)
+        {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+// Scans one word starting at p.pos. Quotes and backslashes are kept in the
+// text (expand_word removes them later) but hide operators from the lexer.
+static void scan_word(Parser &p)
+{
+    const std::string &s = p.src;
+    size_t i = p.pos;
+    while (i < s.size() && !is_meta(s[i]))
+    {
+        char c = s[i];
+        if (c == '\\')
+        {
+            if (i + 1 >= s.size())
+                return fail_in_word(p, 0, "unexpected end of input after \\");
+            i += 2;
+        }
+        else if (c == '\'')
+        {
+            size_t close = s.find('\'', i + 1);
+            if (close == std::string::npos)
+                return fail_in_word(p, '\'', "unterminated single quote");
+            i = close + 1;
+        }
+        else if (c == '$' && i + 1 < s.size() && s[i + 1] == '{')
+        {
+            // ${NAME:-default} is one word even with blanks in the default
+            size_t close = s.find('}', i + 2);
+            if (close == std::string::npos)
+                return fail_in_word(p, 0, "unterminated ${");
+            i = close + 1;
+        }
+        else if (c == '$' && i + 1 < s.size() && s[i + 1] == '(')
+        {
+            // A command substitution is one word, operators and all
+            size_t close = find_substitution_end(s, i + 1);
+            if (close == std::string::npos)
+                return fail_in_word(p, 0, "unterminated $(");
+            i = close + 1;
+        }
+        else if (c == '`')
+        {
+            size_t close = find_backquote_end(s, i);
+            if (close == std::string::npos)
+                return fail_in_word(p, 0, "unterminated `");
+            i = close + 1;
+        }
+        else if (c == '"')
+        {
+            i++;
+            while (i < s.size() && s[i] != '"')
+            {
+                if (s[i] == '$' && i + 1 < s.size() && s[i + 1] == '(')
+                {
+                    size_t close = find_substitution_end(s, i + 1);
+                    if (close == std::string::npos)
+                        return fail_in_word(p, 0, "unterminated $(");
+                    i = close + 1;
+                }
+                else
+                    i += (s[i] == '\\' && i + 1 < s.size()) ? 2 : 1;
+            }
+            if (i >= s.size())
+                return fail_in_word(p, '"', "unterminated double quote");
+            i++;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    p.tok.type = TOK_WORD;
+    p.tok.text.assign(s, p.pos, i - p.pos);
+    p.pos = i;
+}
+
+static void next_token(Parser &p)
+{
+    const std::string &s = p.src;
+    p.last_end = p.tok.end;
+
+    // Skip blanks and comments ('#' at the start of a word)
+    while (p.pos < s.size())
+    {
+        if (s[p.pos] == ' ' || s[p.pos] == '\t' || s[p.pos] == '\r')
+            p.pos++;
+        else if (s[p.pos] == '#')
+        {
+            while (p.pos < s.size() && s[p.pos] != '\n')
+                p.pos++;
+        }
+        else
+            break;
+    }
+
+    p.tok.start = p.pos;
+    p.tok.io_number = -1;
+    p.tok.text.clear();
+
+    if (p.pos >= s.size())
+    {
+        p.tok.type = TOK_EOF;
+        p.tok.end = p.pos;
+        return;
+    }
+
+    char c = s[p.pos];
+    char n = p.pos + 1 < s.size() ? s[p.pos + 1] : '\0';
+    switch (c)
+    {
+    case '\n':
+        p.tok.type = TOK_NEWLINE;
+        p.pos++;
+        // Here-document bodies were already read: continue after them
+        if (p.heredoc_pos != std::string::npos)
+        {
+            p.pos = p.heredoc_pos;
+            p.heredoc_pos = std::string::npos;
+        }
+        break;
+    case ';':
+        p.tok.type = n == ';' ? TOK_DSEMI : TOK_SEMI;
+        p.pos += n == ';' ? 2 : 1;
+        break;
+    case '(':
+        p.tok.type = TOK_LPAREN;
+        p.pos++;
+        break;
+    case ')':
+        p.tok.type = TOK_RPAREN;
+        p.pos++;
+        break;
+    case '|':
+        p.tok.type = n == '|' ? TOK_OR : TOK_PIPE;
+        p.pos += n == '|' ? 2 : 1;
+        break;
+    case '&':
+        p.tok.type = n == '&' ? TOK_AND : TOK_AMP;
+        p.pos += n == '&' ? 2 : 1;
+        break;
+    case '<':
+        if (n == '<' && s.compare(p.pos, 3, "<<<") == 0)
+        {
+            p.tok.type = TOK_TLESS;
+            p.pos += 3;
+        }
+        else if (n == '<' && s.compare(p.pos, 3, "<<-") == 0)
+        {
+            p.tok.type = TOK_DLESSDASH;
+            p.pos += 3;
+        }
+        else if (n == '<')
+        {
+            p.tok.type = TOK_DLESS;
+            p.pos += 2;
+        }
+        else
+        {
+            p.tok.type = TOK_LESS;
+            p.pos++;
+        }
+        break;
+    case '>':
+        p.tok.type = n == '>' ? TOK_DGREAT : TOK_GREAT;
+        p.pos += n == '>' ? 2 : 1;
+        break;
+    default:
+        scan_word(p);
+        // "2>file": a number glued to a redirection names the fd
+        if (p.tok.type == TOK_WORD && p.pos < s.size() && (s[p.pos] == '<' || s[p.pos] == '>') &&
+            p.tok.text.size() <= 2 && std::all_of(p.tok.text.begin(), p.tok.text.end(), ::isdigit))
+        {
+            int fd = std::atoi(p.tok.text.c_str());
+            next_token(p);
+            p.tok.io_number = fd;
+            return;
+        }
+        break;
+    }
+    p.tok.end = p.pos;
+}
+
+static bool is_redirect(TokenType type)
+{
+    return type == TOK_LESS || type == TOK_GREAT || type == TOK_DGREAT || type == TOK_DLESS ||
+           type == TOK_DLESSDASH || type == TOK_TLESS;
+}
+
+// Out of input inside a here-document: only its delimiter line can end it
+static void fail_in_heredoc(Parser &p, const std::string &delimiter, bool strip_tabs)
+{
+    bool first = p.status == PARSE_OK;
+    fail(p, PARSE_INCOMPLETE, "here-document delimited by `" + delimiter + "' not finished");
+    if (first)
+    {
+        p.wait.closers.clear();
+        p.wait.heredoc = true;
+        p.wait.delimiter = delimiter;
+        p.wait.strip_tabs = strip_tabs;
+    }
+}
+
+// Reads the body of a here-document whose delimiter was just scanned. The
+// body starts on the line after the command (or after the previous body on
+// the same line) and runs up to a line holding only the delimiter.
+static void read_heredoc(Parser &p, Redirect &redir, bool strip_tabs)
+{
+    // A quoted delimiter ('EOF', "EOF", \EOF) turns off expansion in the body
+    std::string delimiter;
+    for (char c : redir.target)
+    {
+        if (c == '\'' || c == '"' || c == '\\')
+            redir.expand_heredoc = false;
+        else
+            delimiter += c;
+    }
+
+    const std::string &s = p.src;
+    size_t pos = p.heredoc_pos;
+    if (pos == std::string::npos)
+    {
+        size_t line_end = s.find('\n', p.pos);
+        if (line_end == std::string::npos)
+            return fail_in_heredoc(p, delimiter, strip_tabs);
+        pos = line_end + 1;
+    }
+
+    while (true)
+    {
+        if (pos >= s.size())
+            return fail_in_heredoc(p, delimiter, strip_tabs);
+        size_t end = s.find('\n', pos);
+        size_t next = end == std::string::npos ? s.size() : end + 1;
+        if (end == std::string::npos)
+            end = s.size();
+
+        size_t start = pos;
+        if (strip_tabs)
+        {
+            while (start < end && s[start] == '\t')
+                start++;
+        }
+        pos = next;
+        if (s.compare(start, end - start, delimiter) == 0 && end - start == delimiter.size())
+            break;
+        redir.heredoc.append(s, start, next - start);
+        if (next == s.size() && end == s.size())
+            redir.heredoc += '\n'; // last line without a newline
+    }
+    p.heredoc_pos = pos;
+}
+
+static void skip_newlines(Parser &p)
+{
+    while (p.tok.type == TOK_NEWLINE)
+        next_token(p);
+}
+
+// After '|', '&&' or '||' the next command may be on a following line;
+// running out of input there means the line is not finished yet.
+static void expect_more(Parser &p)
+{
+    skip_newlines(p);
+    if (p.tok.type == TOK_EOF)
+        fail(p, PARSE_INCOMPLETE, "unexpected end of input");
+}
+
+static const char *token_name(const Token &tok)
+{
+    switch (tok.type)
+    {
+    case TOK_PIPE:
+        return "|";
+    case TOK_OR:
+        return "||";
+    case TOK_AMP:
+        return "&";
+    case TOK_AND:
+        return "&&";
+    case TOK_SEMI:
+        return ";";
+    case TOK_DSEMI:
+        return ";;";
+    case TOK_LPAREN:
+        return "(";
+    case TOK_RPAREN:
+        return ")";
+    case TOK_WORD:
+        return tok.text.c_str();
+    case TOK_NEWLINE:
+        return "newline";
+    case TOK_LESS:
+        return "<";
+    case TOK_GREAT:
+        return ">";
+    case TOK_DGREAT:
+        return ">>";
+    case TOK_DLESS:
+        return "<<";
+    case TOK_DLESSDASH:
+        return "<<-";
+    case TOK_TLESS:
+        return "<<<";
+    default:
+        return "end of input";
+    }
+}
+
+static void syntax_error(Parser &p)
+{
+    fail(p, PARSE_ERROR, std::string("syntax error near unexpected token `") + token_name(p.tok) + "'");
+}
+
+// A variable name in the first len characters of word
+static bool is_name(const std::string &word, size_t len)
+{
+    if (len == 0 || std::isdigit((unsigned char)word[0]))
+        return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!std::isalnum((unsigned char)word[i]) && word[i] != '_')
+            return false;
+    }
+    return true;
+}
+
+// NAME=value with an unquoted, valid name
+static bool is_assignment(const std::string &word)
+{
+    size_t eq = word.find('=');
+    return eq != std::string::npos && is_name(word, eq);
+}
+
+static bool parse_list(Parser &p, Node &list, const char *const *ends = nullptr);
+static bool parse_command(Parser &p, Node &cmd);
+
+// An unquoted reserved word in command position (quotes stay in the text,
+// so "if" never matches)
+static bool is_keyword(const Parser &p, const char *word)
+{
+    return p.tok.type == TOK_WORD && p.tok.text == word;
+}
+
+static const char *const CLOSING_KEYWORDS[] = {"then", "elif", "else", "fi", "do", "done", "esac", "}", nullptr};
+
+// Cheap test before comparing against every reserved word: all of them are
+// short and start with one of these characters
+static bool may_be_keyword(const Parser &p)
+{
+    return p.tok.type == TOK_WORD && p.tok.text.size() <= 8 && p.tok.text.size() > 0 &&
+           strchr("iwufc{}tedf", p.tok.text[0]) != NULL;
+}
+
+static bool expect_keyword(Parser &p, const char *word)
+{
+    if (is_keyword(p, word))
+    {
+        next_token(p);
+        return true;
+    }
+    if (p.tok.type == TOK_EOF)
+        fail(p, PARSE_INCOMPLETE, std::string("expected `") + word + "'");
+    else
+        syntax_error(p);
+    return false;
+}
+
+// A compound command's list up to one of ends; it may not be empty
+static bool parse_body(Parser &p, Node &body, const char *const *ends)
+{
+    if (!parse_list(p, body, ends))
+        return false;
+    if (body.children.empty())
+    {
+        syntax_error(p);
+        return false;
+    }
+    return true;
+}
+
+// Reads the redirection at p.tok into cmd
+static bool parse_redirect(Parser &p, Node &cmd)
+{
+    Redirect redir;
+    TokenType op = p.tok.type;
+    switch (op)
+    {
+    case TOK_LESS:
+        redir.type = REDIR_IN;
+        break;
+    case TOK_GREAT:
+        redir.type = REDIR_OUT;
+        break;
+    case TOK_DGREAT:
+        redir.type = REDIR_APPEND;
+        break;
+    case TOK_TLESS:
+        redir.type = REDIR_HERESTRING;
+        break;
+    default:
+        redir.type = REDIR_HEREDOC;
+        break;
+    }
+    bool input = redir.type != REDIR_OUT && redir.type != REDIR_APPEND;
+    redir.fd = p.tok.io_number != -1 ? p.tok.io_number : (input ? 0 : 1);
+    next_token(p);
+    if (p.tok.type != TOK_WORD)
+    {
+        if (p.tok.type == TOK_EOF && p.status == PARSE_OK)
+            fail(p, PARSE_ERROR, "syntax error: missing file name after redirection");
+        else
+            syntax_error(p);
+        return false;
+    }
+    redir.target = std::move(p.tok.text);
+    if (redir.type == REDIR_HEREDOC)
+    {
+        read_heredoc(p, redir, op == TOK_DLESSDASH);
+        if (p.status != PARSE_OK)
+            return false;
+    }
+    cmd.redirects.push_back(std::move(redir));
+    return true;
+}
+
+// if list; then list; [elif list; then list;]... [else list;] fi
+// children: condition, body, condition, body..., and the else body last
+static bool parse_if(Parser &p, Node &cmd)
+{
+    static const char *const then_end[] = {"then", nullptr};
+    static const char *const body_end[] = {"elif", "else", "fi", nullptr};
+    static const char *const else_end[] = {"fi", nullptr};
+    cmd.type = NODE_IF;
+    next_token(p);
+    while (true)
+    {
+        cmd.children.emplace_back();
+        if (!parse_body(p, cmd.children.back(), then_end) || !expect_keyword(p, "then"))
+            return false;
+        cmd.children.emplace_back();
+        if (!parse_body(p, cmd.children.back(), body_end))
+            return false;
+        if (!is_keyword(p, "elif"))
+            break;
+        next_token(p);
+    }
+    if (is_keyword(p, "else"))
+    {
+        next_token(p);
+        cmd.children.emplace_back();
+        if (!parse_body(p, cmd.children.back(), else_end))
+            return false;
+    }
+    return expect_keyword(p, "fi");
+}
+
+// while/until list; do list; done -- children: condition, body
+static bool parse_while(Parser &p, Node &cmd)
+{
+    static const char *const do_end[] = {"do", nullptr};
+    static const char *const done_end[] = {"done", nullptr};
+    cmd.type = p.tok.text == "while" ? NODE_WHILE : NODE_UNTIL;
+    next_token(p);
+    cmd.children.resize(2);
+    return parse_body(p, cmd.children[0], do_end) && expect_keyword(p, "do") &&
+           parse_body(p, cmd.children[1], done_end) && expect_keyword(p, "done");
+}
+
+// for NAME [in word...]; do list; done -- words: the raw items, children: body
+static bool parse_for(Parser &p, Node &cmd)
+{
+    static const char *const done_end[] = {"done", nullptr};
+    cmd.type = NODE_FOR;
+    next_token(p);
+    if (p.tok.type != TOK_WORD || !is_name(p.tok.text, p.tok.text.size()))
+    {
+        if (p.tok.type == TOK_EOF && p.status == PARSE_OK)
+        {
+            fail(p, PARSE_INCOMPLETE, "expected a variable name after `for'");
+            p.wait.closers.clear(); // the name could look like a keyword
+        }
+        else
+            syntax_error(p);
+        return false;
+    }
+    cmd.name = p.tok.text;
+    next_token(p);
+    skip_newlines(p);
+
+    if (is_keyword(p, "in"))
+    {
+        next_token(p);
+        while (p.tok.type == TOK_WORD)
+        {
+            cmd.words.push_back(std::move(p.tok.text));
+            next_token(p);
+        }
+        if (p.tok.type != TOK_SEMI && p.tok.type != TOK_NEWLINE)
+        {
+            if (p.tok.type == TOK_EOF && p.status == PARSE_OK)
+                fail(p, PARSE_INCOMPLETE, "expected `do'");
+            else
+                syntax_error(p);
+            return false;
+        }
+        next_token(p);
+    }
+    else
+    {
+        cmd.words.push_back("\"$@\""); // no "in": the positional parameters
+        if (p.tok.type == TOK_SEMI)
+            next_token(p);
+    }
+    skip_newlines(p);
+
+    cmd.children.resize(1);
+    return expect_keyword(p, "do") && parse_body(p, cmd.children[0], done_end) && expect_keyword(p, "done");
+}
+
+// case word in [(]pattern[|pattern]...) list ;; ... esac
+// words: the subject; children: one list per item, its patterns in words
+static bool parse_case(Parser &p, Node &cmd)
+{
+    static const char *const item_end[] = {"esac", nullptr};
+    cmd.type = NODE_CASE;
+    next_token(p);
+    if (p.tok.type != TOK_WORD)
+    {
+        syntax_error(p);
+        return false;
+    }
+    cmd.words.push_back(std::move(p.tok.text));
+    next_token(p);
+    skip_newlines(p);
+    if (!expect_keyword(p, "in"))
+        return false;
+    skip_newlines(p);
+
+    while (!is_keyword(p, "esac"))
+    {
+        if (p.tok.type == TOK_LPAREN)
+            next_token(p);
+        cmd.children.emplace_back();
+        Node &item = cmd.children.back();
+        while (true)
+        {
+            if (p.tok.type != TOK_WORD)
+            {
+                if (p.tok.type == TOK_EOF && p.status == PARSE_OK)
+                    fail(p, PARSE_INCOMPLETE, "expected `esac'");
+                else
+                    syntax_error(p);
+                return false;
+            }
+            item.words.push_back(std::move(p.tok.text));
+            next_token(p);
+            if (p.tok.type != TOK_PIPE)
+                break;
+            next_token(p);
+        }
+        if (p.tok.type != TOK_RPAREN)
+        {
+            syntax_error(p);
+            return false;
+        }
+        next_token(p);
+
+        // The list may be empty ("*) ;;") and ends at ;; or esac
+        std::vector<std::string> patterns = std::move(item.words);
+        if (!parse_list(p, item, item_end))
+            return false;
+        item.words = std::move(patterns);
+        if (p.tok.type == TOK_DSEMI)
+        {
+            next_token(p);
+            skip_newlines(p);
+        }
+        else if (!is_keyword(p, "esac"))
+        {
+            syntax_error(p);
+            return false;
+        }
+    }
+    next_token(p);
+    return true;
+}
+
+// { list; }
+static bool parse_group(Parser &p, Node &cmd)
+{
+    static const char *const group_end[] = {"}", nullptr};
+    cmd.type = NODE_GROUP;
+    next_token(p);
+    cmd.children.resize(1);
+    return parse_body(p, cmd.children[0], group_end) && expect_keyword(p, "}");
+}
+
+static bool is_compound(const Node &cmd)
+{
+    return cmd.type != NODE_COMMAND && cmd.type != NODE_FUNCTION;
+}
+
+// The body of "name() compound-command" or "function name [()] compound"
+static bool parse_function_body(Parser &p, Node &cmd, const std::string &name)
+{
+    cmd.type = NODE_FUNCTION;
+    cmd.name = name;
+    cmd.words.clear();
+    skip_newlines(p);
+    if (p.tok.type == TOK_EOF)
+    {
+        fail(p, PARSE_INCOMPLETE, "expected a function body");
+        return false;
+    }
+    cmd.children.resize(1);
+    if (!parse_command(p, cmd.children[0]))
+        return false;
+    if (!is_compound(cmd.children[0]))
+    {
+        fail(p, PARSE_ERROR, "syntax error: function body must be a compound command like { ...; }");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_function(Parser &p, Node &cmd)
+{
+    next_token(p);
+    if (p.tok.type != TOK_WORD)
+    {
+        syntax_error(p);
+        return false;
+    }
+    std::string name = std::move(p.tok.text);
+    next_token(p);
+    if (p.tok.type == TOK_LPAREN)
+    {
+        next_token(p);
+        if (p.tok.type != TOK_RPAREN)
+        {
+            syntax_error(p);
+            return false;
+        }
+        next_token(p);
+    }
+    return parse_function_body(p, cmd, name);
+}
+
+// The reserved word that ends the compound command p.tok starts, if any
+static const char *closing_word(const Parser &p)
+{
+    if (is_keyword(p, "if"))
+        return "fi";
+    if (is_keyword(p, "while") || is_keyword(p, "until") || is_keyword(p, "for"))
+        return "done";
+    if (is_keyword(p, "case"))
+        return "esac";
+    if (is_keyword(p, "{"))
+        return "}";
+    return nullptr;
+}
+
+static bool parse_command(Parser &p, Node &cmd)
+{
+    cmd.type = NODE_COMMAND;
+    size_t start = p.tok.start;
+
+    // Compound commands, which may be followed by redirections
+    if (may_be_keyword(p))
+    {
+        const char *closer = closing_word(p);
+        if (closer != nullptr)
+            p.open.push_back(closer);
+        bool compound = true;
+        if (is_keyword(p, "if"))
+            parse_if(p, cmd);
+        else if (is_keyword(p, "while") || is_keyword(p, "until"))
+            parse_while(p, cmd);
+        else if (is_keyword(p, "for"))
+            parse_for(p, cmd);
+        else if (is_keyword(p, "case"))
+            parse_case(p, cmd);
+        else if (is_keyword(p, "{"))
+            parse_group(p, cmd);
+        else if (is_keyword(p, "function"))
+            parse_function(p, cmd);
+        else
+            compound = false;
+        if (closer != nullptr)
+            p.open.pop_back();
+        if (compound)
+        {
+            while (p.status == PARSE_OK && cmd.type != NODE_FUNCTION && is_redirect(p.tok.type))
+            {
+                if (!parse_redirect(p, cmd))
+                    return false;
+                next_token(p);
+            }
+            cmd.text.assign(p.src, start, p.last_end - start);
+            return p.status == PARSE_OK;
+        }
+        for (const char *const *word = CLOSING_KEYWORDS; *word != nullptr; word++)
+        {
+            if (is_keyword(p, *word))
+            {
+                syntax_error(p);
+                return false;
+            }
+        }
+    }
+
+    while (p.tok.type == TOK_WORD || is_redirect(p.tok.type))
+    {
+        if (p.tok.type == TOK_WORD)
+        {
+            // Assignments count only before the command name
+            if (cmd.words.empty() && is_assignment(p.tok.text))
+                cmd.assigns.push_back(std::move(p.tok.text));
+            else
+                cmd.words.push_back(std::move(p.tok.text));
+        }
+        else if (!parse_redirect(p, cmd))
+        {
+            return false;
+        }
+        next_token(p);
+
+        // "name() { ...; }" defines a function
+        if (p.tok.type == TOK_LPAREN && cmd.words.size() == 1 && cmd.assigns.empty() && cmd.redirects.empty())
+        {
+            next_token(p);
+            if (p.tok.type != TOK_RPAREN)
+            {
+                syntax_error(p);
+                return false;
+            }
+            next_token(p);
+            if (!parse_function_body(p, cmd, cmd.words[0]))
+                return false;
+            cmd.text.assign(p.src, start, p.last_end - start);
+            return true;
+        }
+    }
+
+    if (cmd.words.empty() && cmd.redirects.empty() && cmd.assigns.empty())
+    {
+        syntax_error(p);
+        return false;
+    }
+    cmd.text.assign(p.src, start, p.last_end - start);
+    return p.status == PARSE_OK;
+}
+
+static bool parse_pipeline(Parser &p, Node &pipeline)
+{
+    pipeline.type = NODE_PIPELINE;
+
+    // "! pipeline" inverts its status
+    if (is_keyword(p, "!"))
+    {
+        pipeline.negate = true;
+        next_token(p);
+    }
+
+    // "time [-p | --json] pipeline" (a quoted 'time' is the command)
+    if (p.tok.type == TOK_WORD && p.tok.text == "time")
+    {
+        pipeline.time_format = TIME_DEFAULT;
+        next_token(p);
+        while (p.tok.type == TOK_WORD && (p.tok.text == "-p" || p.tok.text == "--json"))
+        {
+            pipeline.time_format = p.tok.text == "-p" ? TIME_POSIX : TIME_JSON;
+            next_token(p);
+        }
+    }
+
+    // "job [-C cpus] [-N nice] [-H] ... [--] pipeline": the options and
+    // their values are expanded and checked when the pipeline runs
+    if (p.tok.type == TOK_WORD && p.tok.text == "job")
+    {
+        next_token(p);
+        while (p.tok.type == TOK_WORD && p.tok.text[0] == '-')
+        {
+            bool last = p.tok.text == "--";
+            pipeline.job_options.push_back(p.tok.text);
+            next_token(p);
+            if (last)
+                break;
+            if (p.tok.type == TOK_WORD && placement_option_has_value(pipeline.job_options.back()))
+            {
+                pipeline.job_options.push_back(p.tok.text);
+                next_token(p);
+            }
+        }
+    }
+    size_t start = p.tok.start;
+
+    while (true)
+    {
+        pipeline.children.emplace_back();
+        if (!parse_command(p, pipeline.children.back()))
+            return false;
+        if (p.tok.type != TOK_PIPE)
+            break;
+        next_token(p);
+        expect_more(p);
+        if (p.status != PARSE_OK)
+            return false;
+    }
+
+    pipeline.text.assign(p.src, start, p.last_end - start);
+    return true;
+}
+
+static bool parse_and_or(Parser &p, Node &and_or)
+{
+    and_or.type = NODE_AND_OR;
+    size_t start = p.tok.start;
+
+    while (true)
+    {
+        and_or.children.emplace_back();
+        if (!parse_pipeline(p, and_or.children.back()))
+            return false;
+        if (p.tok.type != TOK_AND && p.tok.type != TOK_OR)
+            break;
+        and_or.or_ops.push_back(p.tok.type == TOK_OR);
+        next_token(p);
+        expect_more(p);
+        if (p.status != PARSE_OK)
+            return false;
+    }
+
+    and_or.text.assign(p.src, start, p.last_end - start);
+    return true;
+}
+
+// Is p.tok one of the words that end this list (or the ";;" of a case item)?
+static bool at_list_end(const Parser &p, const char *const *ends)
+{
+    if (ends == nullptr)
+        return false;
+    if (p.tok.type == TOK_DSEMI)
+        return true;
+    for (; *ends != nullptr; ends++)
+    {
+        if (is_keyword(p, *ends))
+            return true;
+    }
+    return false;
+}
+
+// A list up to the end of input, or inside a compound command up to one of
+// the reserved words in ends (which is left as the current token)
+static bool parse_list(Parser &p, Node &list, const char *const *ends)
+{
+    list.type = NODE_LIST;
+
+    skip_newlines(p);
+    while (p.tok.type != TOK_EOF && !at_list_end(p, ends))
+    {
+        list.children.emplace_back();
+        Node &item = list.children.back();
+        if (!parse_and_or(p, item))
+            return false;
+
+        if (p.tok.type == TOK_AMP)
+            item.background = true;
+        else if (p.tok.type == TOK_DSEMI && ends != nullptr)
+            break;
+        else if (p.tok.type != TOK_SEMI && p.tok.type != TOK_NEWLINE && p.tok.type != TOK_EOF)
+        {
+            syntax_error(p);
+            return false;
+        }
+        if (p.tok.type != TOK_EOF)
+            next_token(p);
+        skip_newlines(p);
+    }
+    if (ends != nullptr && p.tok.type == TOK_EOF)
+        fail(p, PARSE_INCOMPLETE, "unexpected end of input");
+    return p.status == PARSE_OK;
+}
+
+// wait, if given, is filled in when the input is incomplete
+ParseStatus parse_command_line(const std::string &input, Node &tree, std::string &error, ParseWait *wait)
+{
+    Parser p{input, 0, Token(), 0, PARSE_OK, "", std::string::npos, {}, ParseWait()};
+    tree = Node();
+    next_token(p);
+    parse_list(p, tree);
+    error = p.error;
+    if (wait != nullptr)
+        *wait = p.status == PARSE_INCOMPLETE ? std::move(p.wait) : ParseWait();
+    return p.status;
+}
+
+// Could appending line finish the input an incomplete parse stopped in?
+// Errs towards yes: a false no would hold back a command that is complete.
+// Inside compound commands it lexes just the new line and counts its
+// reserved words, so a long loop body is not parsed again line by line.
+bool line_may_finish(ParseWait &wait, const std::string &line)
+{
+    if (wait.heredoc)
+    {
+        size_t start = 0;
+        while (wait.strip_tabs && start < line.size() && line[start] == '\t')
+            start++;
+        return line.compare(start, std::string::npos, wait.delimiter) == 0;
+    }
+    if (wait.quote != 0)
+        return line.find(wait.quote) != std::string::npos;
+    if (wait.closers.empty() || (!line.empty() && line.back() == '\\'))
+        return true;
+
+    std::string text = line + "\n";
+    Parser p{text, 0, Token(), 0, PARSE_OK, "", std::string::npos, {}, ParseWait()};
+    std::vector<Token> tokens;
+    for (next_token(p); p.tok.type != TOK_EOF; next_token(p))
+    {
+        // A here-document or a quote running on: parse it properly
+        if (p.tok.type == TOK_DLESS || p.tok.type == TOK_DLESSDASH)
+            return true;
+        tokens.push_back(p.tok);
+    }
+    if (p.status != PARSE_OK)
+        return true;
+
+    // Closers count anywhere, openers only where a command starts and not
+    // as a case pattern ("if)"), so the balance is never too low
+    static const char *const STARTS_COMMAND[] = {"if", "while", "until", "then", "do", "else", "elif", "{", "!", nullptr};
+    bool command_start = true;
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        const Token &tok = tokens[i];
+        if (tok.type != TOK_WORD)
+        {
+            command_start = !is_redirect(tok.type);
+            continue;
+        }
+        if (tok.text == "fi" || tok.text == "done" || tok.text == "esac" || tok.text == "}")
+            wait.balance[tok.text]++;
+        else if (command_start && (i + 1 == tokens.size() ||
+                                   (tokens[i + 1].type != TOK_RPAREN && tokens[i + 1].type != TOK_PIPE)))
+        {
+            p.tok = tok;
+            const char *closer = closing_word(p);
+            if (closer != nullptr)
+                wait.balance[closer]--;
+        }
+        bool starts = false;
+        for (const char *const *word = STARTS_COMMAND; *word != nullptr && command_start; word++)
+            starts = starts || tok.text == *word;
+        command_start = starts;
+    }
+
+    std::map<std::string, int> needed;
+    for (const std::string &closer : wait.closers)
+        needed[closer]++;
+    for (const auto &need : needed)
+    {
+        if (wait.balance[need.first] < need.second)
+            return false;
+    }
+    return true;
+}
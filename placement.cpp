@@ -0,0 +1,444 @@
+// Library includes
+#include "SHELL.h"
+#include <sched.h>
+#include <sys/syscall.h>
+
+// Where a job runs and what it may use: CPU affinity, nice level, I/O
+// priority and resource limits. "job [options] pipeline" sets them when a
+// job starts, "bg [options] %jid" changes them on a job that is already
+// running (every process in its group, including ones it forked since),
+// and ulimit sets the shell's own limits, which every command inherits.
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static const char *IO_CLASSES[] = {"none", "realtime", "best-effort", "idle"};
+
+// The limits ulimit knows, by option letter; job and bg take the same
+// letters (and a few long names)
+struct LimitInfo
+{
+    char option;
+    int resource;
+    rlim_t unit; // bytes per unit shown, or 1
+    const char *description;
+    const char *long_name; // job/bg, or NULL
+    const char *label;     // jobs -l
+};
+
+static const LimitInfo LIMITS[] = {
+    {'c', RLIMIT_CORE, 1024, "core file size (KiB)", NULL, "core"},
+    {'d', RLIMIT_DATA, 1024, "data seg size (KiB)", NULL, "data"},
+    {'f', RLIMIT_FSIZE, 1024, "file size (KiB)", "--file-size", "fsize"},
+    {'l', RLIMIT_MEMLOCK, 1024, "max locked memory (KiB)", NULL, "memlock"},
+    {'n', RLIMIT_NOFILE, 1, "open files", "--files", "files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (KiB)", NULL, "stack"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)", "--cpu-time", "cpu"},
+    {'u', RLIMIT_NPROC, 1, "max user processes", NULL, "nproc"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (KiB)", "--mem", "mem"},
+};
+
+// "0-3,8" -> a cpu set
+static bool parse_cpu_list(const std::string &list, cpu_set_t &set)
+{
+    CPU_ZERO(&set);
+    std::istringstream items(list);
+    std::string item;
+    bool any = false;
+    while (std::getline(items, item, ','))
+    {
+        char *end;
+        long first = std::strtol(item.c_str(), &end, 10);
+        long last = first;
+        if (end == item.c_str())
+            return false;
+        if (*end == '-')
+        {
+            const char *from = end + 1;
+            last = std::strtol(from, &end, 10);
+            if (end == from)
+                return false;
+        }
+        if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, &set);
+        any = true;
+    }
+    return any;
+}
+
+// "512M", "2G", "1048576" or "unlimited" (K/M/G/T are powers of 1024)
+static bool parse_size(const std::string &text, rlim_t unit, rlim_t &value)
+{
+    if (text == "unlimited")
+    {
+        value = RLIM_INFINITY;
+        return true;
+    }
+    char *end;
+    unsigned long long n = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || text[0] == '-')
+        return false;
+    const char *suffixes = "KMGT";
+    if (*end != '\0')
+    {
+        const char *at = strchr(suffixes, toupper(*end));
+        if (at == NULL || *at == '\0' || end[1] != '\0')
+            return false;
+        unit = 1ULL << (10 * (at - suffixes + 1));
+    }
+    // Too big (RLIM_INFINITY itself would read as "unlimited")
+    if (n > (RLIM_INFINITY - 1) / unit)
+        return false;
+    value = n * unit;
+    return true;
+}
+
+static std::string format_size(rlim_t value)
+{
+    if (value == RLIM_INFINITY)
+        return "unlimited";
+    const char *suffixes = "KMGT";
+    int shift = 0;
+    while (shift < 4 && value != 0 && value % (1ULL << (10 * (shift + 1))) == 0)
+        shift++;
+    std::string text = std::to_string(value >> (10 * shift));
+    return shift == 0 ? text : text + suffixes[shift - 1];
+}
+
+// The job/bg options besides the limits, and whether a value follows.
+// Upper case, so they never collide with ulimit's letters.
+struct PlacementOption
+{
+    const char *short_name;
+    const char *long_name;
+    bool has_value;
+};
+
+static const PlacementOption OPTIONS[] = {
+    {"-C", "--cpus", true},
+    {"-N", "--nice", true},
+    {"-I", "--ionice", true},
+    {"-H", "--hard", false},
+};
+
+static const PlacementOption *find_option(const std::string &option)
+{
+    for (const PlacementOption &entry : OPTIONS)
+    {
+        if (option == entry.short_name || option == entry.long_name)
+            return &entry;
+    }
+    return NULL;
+}
+
+// "-n" or "--files": a limit, by ulimit's letter or its long name
+static const LimitInfo *find_limit(const std::string &option)
+{
+    for (const LimitInfo &info : LIMITS)
+    {
+        if ((option.size() == 2 && option[0] == '-' && option[1] == info.option) ||
+            (info.long_name != NULL && option == info.long_name))
+            return &info;
+    }
+    return NULL;
+}
+
+// For the parser, which collects the words of a "job" prefix before the
+// options are expanded and checked
+bool placement_option_has_value(const std::string &option)
+{
+    const PlacementOption *entry = find_option(option);
+    return entry != NULL ? entry->has_value : find_limit(option) != NULL;
+}
+
+// Parses the placement options at args[i...] into out, stopping at the
+// first word that is not one (or after "--"). who prefixes the errors.
+bool parse_placement(char **args, size_t &i, JobPlacement &out, const char *who)
+{
+    for (; args[i] != NULL && args[i][0] == '-'; i++)
+    {
+        if (strcmp(args[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        const PlacementOption *entry = find_option(args[i]);
+        const LimitInfo *info = entry == NULL ? find_limit(args[i]) : NULL;
+        if (entry == NULL && info == NULL)
+        {
+            std::cerr << RED << who << ": unknown option " << args[i] << RESET << std::endl;
+            return false;
+        }
+        std::string given = args[i];
+        std::string option = entry != NULL ? entry->short_name : "";
+        if (entry != NULL && !entry->has_value)
+        {
+            out.hard_limits = true; // -H
+            continue;
+        }
+        if (args[i + 1] == NULL)
+        {
+            std::cerr << RED << who << ": " << given << ": needs a value" << RESET << std::endl;
+            return false;
+        }
+        std::string value = args[++i];
+        bool ok = true;
+        if (info != NULL)
+        {
+            rlim_t limit;
+            ok = parse_size(value, info->unit, limit);
+            if (ok)
+                out.limits[info->resource] = limit;
+        }
+        else if (option == "-C")
+        {
+            cpu_set_t set;
+            ok = parse_cpu_list(value, set);
+            out.cpus = value;
+        }
+        else if (option == "-N")
+        {
+            char *end;
+            long nice = std::strtol(value.c_str(), &end, 10);
+            ok = *end == '\0' && !value.empty() && nice >= -20 && nice <= 19;
+            out.set_nice = true;
+            out.nice = nice;
+        }
+        else // -I
+        {
+            // class[:level]: idle, best-effort (be) or realtime (rt), level 0-7
+            size_t colon = value.find(':');
+            std::string name = value.substr(0, colon);
+            if (name == "be")
+                name = "best-effort";
+            else if (name == "rt")
+                name = "realtime";
+            out.io_class = -1;
+            for (int c = 1; c <= 3; c++)
+            {
+                if (name == IO_CLASSES[c])
+                    out.io_class = c;
+            }
+            out.io_level = 4;
+            if (colon != std::string::npos)
+                out.io_level = std::atoi(value.c_str() + colon + 1);
+            ok = out.io_class > 0 && out.io_level >= 0 && out.io_level <= 7;
+        }
+        if (!ok)
+        {
+            std::cerr << RED << who << ": " << given << ": invalid value '" << value << "'" << RESET << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Settings given later replace the same settings given earlier
+void merge_placement(JobPlacement &into, const JobPlacement &from)
+{
+    if (!from.cpus.empty())
+        into.cpus = from.cpus;
+    if (from.set_nice)
+    {
+        into.set_nice = true;
+        into.nice = from.nice;
+    }
+    if (from.io_class > 0)
+    {
+        into.io_class = from.io_class;
+        into.io_level = from.io_level;
+    }
+    for (const auto &limit : from.limits)
+        into.limits[limit.first] = limit.second;
+    into.hard_limits = into.hard_limits || from.hard_limits;
+}
+
+// For jobs -l: "cpus=0-3 nice=10 io=idle mem=2G files=1024 cpu=60s"
+std::string describe_placement(const JobPlacement &placement)
+{
+    std::string text;
+    auto add = [&](const std::string &item) {
+        text += (text.empty() ? "" : " ") + item;
+    };
+    if (!placement.cpus.empty())
+        add("cpus=" + placement.cpus);
+    if (placement.set_nice)
+        add("nice=" + std::to_string(placement.nice));
+    if (placement.io_class > 0)
+        add(std::string("io=") + IO_CLASSES[placement.io_class] +
+            (placement.io_class != 3 ? ":" + std::to_string(placement.io_level) : ""));
+    for (const auto &limit : placement.limits)
+    {
+        for (const LimitInfo &info : LIMITS)
+        {
+            if (info.resource != limit.first)
+                continue;
+            std::string value;
+            if (limit.second == RLIM_INFINITY || info.unit != 1)
+                value = format_size(limit.second);
+            else
+                value = std::to_string(limit.second) + (limit.first == RLIMIT_CPU ? "s" : "");
+            add(std::string(info.label) + "=" + value);
+        }
+    }
+    if (placement.hard_limits && !placement.limits.empty())
+        add("hard");
+    return text;
+}
+
+// Every process in the group, not just the ones the shell started
+static void group_members(pid_t pgid, std::vector<pid_t> &pids)
+{
+    DIR *proc = opendir("/proc");
+    if (proc == NULL)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL)
+    {
+        if (!isdigit((unsigned char)entry->d_name[0]))
+            continue;
+        pid_t pid = std::atoi(entry->d_name);
+        if (getpgid(pid) == pgid && std::find(pids.begin(), pids.end(), pid) == pids.end())
+            pids.push_back(pid);
+    }
+    closedir(proc);
+}
+
+// Applies placement to pids, plus the rest of group pgid if pgid > 0.
+// Reports the first failure; the other settings are still applied.
+bool apply_placement(const JobPlacement &placement, std::vector<pid_t> pids, pid_t pgid, const char *who)
+{
+    if (pgid > 0)
+        group_members(pgid, pids);
+
+    std::string error;
+    auto fail = [&](const char *what) {
+        if (error.empty())
+            error = std::string(what) + ": " + strerror(errno);
+    };
+    cpu_set_t set;
+    bool has_cpus = !placement.cpus.empty() && parse_cpu_list(placement.cpus, set);
+    int ioprio = (placement.io_class << IOPRIO_CLASS_SHIFT) | placement.io_level;
+
+    for (pid_t pid : pids)
+    {
+        if (has_cpus && sched_setaffinity(pid, sizeof(set), &set) < 0 && errno != ESRCH)
+            fail("cpus");
+        if (placement.set_nice && setpriority(PRIO_PROCESS, pid, placement.nice) < 0 && errno != ESRCH)
+            fail("nice");
+        if (placement.io_class > 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, ioprio) < 0 && errno != ESRCH)
+            fail("ionice");
+        for (const auto &limit : placement.limits)
+        {
+            // Only the soft limit, so it can be raised again later; -H
+            // sets the hard one too, which only root can raise afterwards
+            enum __rlimit_resource resource = (enum __rlimit_resource)limit.first;
+            struct rlimit wanted;
+            if (prlimit(pid, resource, NULL, &wanted) < 0)
+                continue; // gone
+            wanted.rlim_cur = limit.second;
+            if (placement.hard_limits)
+                wanted.rlim_max = limit.second;
+            else if (limit.second > wanted.rlim_max)
+            {
+                errno = EPERM;
+                fail("limit above the hard limit (use -H)");
+                continue;
+            }
+            if (prlimit(pid, resource, &wanted, NULL) < 0 && errno != ESRCH)
+                fail("limit");
+        }
+    }
+    if (error.empty())
+        return true;
+    std::cerr << RED << who << ": " << error << RESET << std::endl;
+    return false;
+}
+
+static void print_limit(const LimitInfo &info, bool hard, bool with_name)
+{
+    struct rlimit rl;
+    getrlimit(info.resource, &rl);
+    rlim_t value = hard ? rl.rlim_max : rl.rlim_cur;
+    if (with_name)
+    {
+        std::string name = info.description;
+        name.resize(26, ' ');
+        std::cout << name << "(-" << info.option << ") ";
+    }
+    if (value == RLIM_INFINITY)
+        std::cout << "unlimited" << std::endl;
+    else
+        std::cout << value / info.unit << std::endl;
+}
+
+// ulimit [-H | -S] [-a] [-cdflnstuv] [limit]
+// Shows or sets the shell's limits, which every command it runs inherits.
+// Sizes are in KiB (K/M/G suffixes are accepted); with neither -H nor -S
+// both the soft and the hard limit are set.
+int ulimit_builtin(char **args)
+{
+    bool hard = false, soft = false, all = false;
+    const LimitInfo *info = &LIMITS[2]; // -f, like other shells
+    size_t i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        for (const char *c = args[i] + 1; *c != '\0'; c++)
+        {
+            if (*c == 'H')
+                hard = true;
+            else if (*c == 'S')
+                soft = true;
+            else if (*c == 'a')
+                all = true;
+            else
+            {
+                info = NULL;
+                for (const LimitInfo &known : LIMITS)
+                {
+                    if (known.option == *c)
+                        info = &known;
+                }
+                if (info == NULL)
+                {
+                    std::cerr << RED << "ulimit: -" << *c << ": invalid option" << RESET << std::endl;
+                    std::cerr << RED << "Usage: ulimit [-H | -S] [-a] [-cdflnstuv] [limit]" << RESET << std::endl;
+                    return 2;
+                }
+            }
+        }
+    }
+
+    if (all)
+    {
+        for (const LimitInfo &known : LIMITS)
+            print_limit(known, hard, true);
+        return 0;
+    }
+    if (args[i] == NULL)
+    {
+        print_limit(*info, hard, false);
+        return 0;
+    }
+
+    rlim_t value;
+    if (!parse_size(args[i], info->unit, value))
+    {
+        std::cerr << RED << "ulimit: " << args[i] << ": invalid number" << RESET << std::endl;
+        return 1;
+    }
+    struct rlimit rl;
+    getrlimit(info->resource, &rl);
+    if (hard || !soft)
+        rl.rlim_max = value;
+    if (soft || !hard)
+        rl.rlim_cur = value;
+    if (setrlimit(info->resource, &rl) < 0)
+    {
+        std::cerr << RED << "ulimit: " << info->description << ": " << strerror(errno) << RESET << std::endl;
+        return 1;
+    }
+    return 0;
+}
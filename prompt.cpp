@@ -0,0 +1,392 @@
+// Library includes
+#include "SHELL.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <poll.h>
+#include <sys/syscall.h>
+
+// The prompt, built from the segments named in $PROMPT_SEGMENTS: cwd, git,
+// status, duration and jobs. Everything but git is cheap and computed when
+// the prompt is printed. The git segment comes from the last result for
+// that directory, and a worker thread runs `git status` again in the
+// background, giving up after $PROMPT_TIMEOUT seconds. When it finishes it
+// wakes the editor's poll() and, if the text changed, the prompt and the
+// line being typed are redrawn in place. Typing is never held up by it.
+//
+// git is started with clone3() and no exit signal, so it is a "clone
+// child": the shell's waitpid(-1) / wait4(-1) calls never see it, and the
+// worker alone waits for (and, past the deadline, kills) it via its pidfd.
+
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+// struct clone_args of <linux/sched.h>, as of Linux 5.3
+struct CloneArgs
+{
+    uint64_t flags, pidfd, child_tid, parent_tid, exit_signal, stack, stack_size, tls;
+};
+
+static const char *DEFAULT_SEGMENTS = "cwd git duration status jobs";
+static const double DEFAULT_TIMEOUT = 2.0;
+static const double DURATION_SHOWN_FROM = 2.0; // seconds
+static const size_t GIT_RESULTS_KEPT = 64;
+
+struct GitState
+{
+    bool repo = false;
+    std::string branch; // or the short commit id when detached
+    bool dirty = false;
+    int ahead = 0, behind = 0;
+};
+
+// One `git status` for the worker to run
+struct GitRequest
+{
+    std::string dir;
+    std::string path_var; // $PATH, to find git
+    std::vector<std::string> env;
+    double timeout = DEFAULT_TIMEOUT;
+};
+
+// Shared with the worker, guarded by prompt_mutex. The mutex and condvar
+// are never destroyed: a forked child that ran static destructors would
+// block in pthread_cond_destroy on the worker that is waiting in the parent.
+static std::mutex &prompt_mutex = *new std::mutex;
+static std::condition_variable &prompt_cv = *new std::condition_variable;
+static GitRequest request;
+static bool has_request = false;
+static std::unordered_map<std::string, GitState> git_results; // by directory
+
+static int update_pipe[2] = {-1, -1}; // the worker's "result ready"
+
+// Main thread only
+static double last_duration = 0;
+static std::string shown_prompt;
+static LineView *active_view = NULL; // the line under the prompt, while editing
+static const std::string *active_buffer = NULL;
+static const int *active_cursor = NULL;
+
+static std::string find_git(const std::string &path_var)
+{
+    size_t start = 0;
+    while (start <= path_var.size())
+    {
+        size_t end = path_var.find(':', start);
+        if (end == std::string::npos)
+            end = path_var.size();
+        std::string candidate = path_var.substr(start, end - start) + "/git";
+        start = end + 1;
+        if (candidate[0] == '/' && access(candidate.c_str(), X_OK) == 0)
+            return candidate;
+    }
+    return "";
+}
+
+// "# branch.head main", "# branch.oid <sha>", "# branch.ab +1 -2"
+static void parse_branch_header(const std::string &line, GitState &state)
+{
+    state.repo = true;
+    if (line.compare(0, 14, "# branch.head ") == 0)
+    {
+        if (line.compare(14, std::string::npos, "(detached)") != 0)
+            state.branch = line.substr(14);
+    }
+    else if (line.compare(0, 13, "# branch.oid ") == 0 && state.branch.empty())
+    {
+        state.branch = line.substr(13, 7);
+    }
+    else if (line.compare(0, 12, "# branch.ab ") == 0)
+    {
+        sscanf(line.c_str() + 12, "+%d -%d", &state.ahead, &state.behind);
+    }
+}
+
+// Runs git status in dir; false if it could not start or ran out of time.
+// The branch headers come first, so reading stops at the first changed file.
+static bool run_git_status(const GitRequest &req, GitState &state)
+{
+    static std::string git_path, git_path_var; // the worker's own lookup cache
+    if (git_path.empty() || git_path_var != req.path_var)
+    {
+        git_path = find_git(req.path_var);
+        git_path_var = req.path_var;
+    }
+    if (git_path.empty())
+        return false;
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return false;
+
+    // --no-optional-locks: never take index.lock away from the user's git
+    std::vector<std::string> words = {"git", "--no-optional-locks", "-C", req.dir,
+                                      "status", "--porcelain=v2", "--branch"};
+    std::vector<char *> argv, envp;
+    for (std::string &word : words)
+        argv.push_back(&word[0]);
+    argv.push_back(NULL);
+    for (const std::string &entry : req.env)
+        envp.push_back(const_cast<char *>(entry.c_str()));
+    envp.push_back(NULL);
+
+    sigset_t none;
+    sigemptyset(&none);
+    int pidfd = -1;
+    CloneArgs args = {};
+    args.flags = CLONE_PIDFD;
+    args.pidfd = (uint64_t)(uintptr_t)&pidfd;
+    args.exit_signal = 0; // no SIGCHLD: invisible to waits for any child
+    long pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0)
+    {
+        // Only async-signal-safe calls here: other threads may hold locks.
+        // Its own process group keeps Ctrl+C at the prompt away from it.
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execve(git_path.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]); // e.g. a kernel before 5.3: no git segment
+        return false;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool timed_out = false, done = false, line_start = true;
+    std::string line;
+    char buf[4096];
+    while (!done)
+    {
+        double left = req.timeout - seconds_since(start);
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        int ready = left > 0 ? poll(&pfd, 1, (int)(left * 1000) + 1) : 0;
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+        {
+            timed_out = true;
+            break;
+        }
+        ssize_t n = read(fds[0], buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        for (ssize_t i = 0; i < n && !done; i++)
+        {
+            if (line_start && buf[i] != '#')
+            {
+                state.dirty = true;
+                done = true; // headers are over: nothing else to learn
+            }
+            else if (buf[i] == '\n')
+            {
+                parse_branch_header(line, state);
+                line.clear();
+                line_start = true;
+            }
+            else
+            {
+                line += buf[i];
+                line_start = false;
+            }
+        }
+    }
+    // Once the pipe is closed, a git that is still writing gets SIGPIPE.
+    // Only this thread can reap it, so the pidfd still names our git.
+    close(fds[0]);
+    if (timed_out)
+        syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+    siginfo_t info;
+    while (waitid((idtype_t)P_PIDFD, pidfd, &info, WEXITED | __WALL) < 0 && errno == EINTR)
+        ;
+    close(pidfd);
+    return !timed_out;
+}
+
+static void prompt_thread_main()
+{
+    while (true)
+    {
+        GitRequest req;
+        {
+            std::unique_lock<std::mutex> lock(prompt_mutex);
+            prompt_cv.wait(lock, [] { return has_request; });
+            req = std::move(request);
+            has_request = false;
+        }
+
+        GitState state;
+        if (!run_git_status(req, state))
+            continue; // keep showing the last result
+        {
+            std::lock_guard<std::mutex> lock(prompt_mutex);
+            if (git_results.size() >= GIT_RESULTS_KEPT && git_results.count(req.dir) == 0)
+                git_results.clear();
+            git_results[req.dir] = state;
+        }
+        char c = 1;
+        if (write(update_pipe[1], &c, 1) < 0)
+        {
+            // Pipe full: an update is already pending
+        }
+    }
+}
+
+// Hands the worker a new directory to look at; an older request that has
+// not started yet is replaced
+static void request_git_status(const std::string &dir)
+{
+    if (update_pipe[0] < 0)
+    {
+        if (pipe2(update_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+            return;
+        // SIGCHLD is already blocked, so the thread inherits the mask
+        std::thread(prompt_thread_main).detach();
+    }
+
+    GitRequest req;
+    req.dir = dir;
+    const std::string *path_var = var_get("PATH");
+    req.path_var = path_var != nullptr ? *path_var : "/usr/local/bin:/usr/bin:/bin";
+    for (char **env = var_envp(); *env != NULL; env++)
+        req.env.push_back(*env);
+    const std::string *timeout = var_get("PROMPT_TIMEOUT");
+    if (timeout != nullptr && !timeout->empty())
+        req.timeout = std::atof(timeout->c_str());
+    {
+        std::lock_guard<std::mutex> lock(prompt_mutex);
+        request = std::move(req);
+        has_request = true;
+    }
+    prompt_cv.notify_one();
+}
+
+static std::string format_duration(double seconds)
+{
+    char text[32];
+    if (seconds < 60)
+        snprintf(text, sizeof(text), "%.1fs", seconds);
+    else
+        snprintf(text, sizeof(text), "%dm%02ds", (int)seconds / 60, (int)seconds % 60);
+    return text;
+}
+
+// The prompt text for the current state; asks for a git refresh if wanted
+static std::string build_prompt(bool refresh_git)
+{
+    char cwd[1024];
+    if (NULL == getcwd(cwd, sizeof(cwd)))
+        cwd[0] = '\0';
+
+    const std::string *config = var_get("PROMPT_SEGMENTS");
+    std::istringstream names(config != nullptr ? *config : DEFAULT_SEGMENTS);
+    std::string prompt, name;
+    auto add = [&](const char *color, const std::string &text) {
+        if (!prompt.empty())
+            prompt += " ";
+        prompt += color + text + RESET;
+    };
+    while (names >> name)
+    {
+        if (name == "cwd")
+        {
+            add(GREEN, cwd);
+        }
+        else if (name == "git")
+        {
+            if (refresh_git && cwd[0] != '\0')
+                request_git_status(cwd);
+            GitState state;
+            {
+                std::lock_guard<std::mutex> lock(prompt_mutex);
+                auto it = git_results.find(cwd);
+                if (it != git_results.end())
+                    state = it->second;
+            }
+            if (!state.repo)
+                continue;
+            std::string text = "(" + state.branch + (state.dirty ? "*" : "");
+            if (state.ahead > 0)
+                text += " +" + std::to_string(state.ahead);
+            if (state.behind > 0)
+                text += " -" + std::to_string(state.behind);
+            add(YELLOW, text + ")");
+        }
+        else if (name == "status")
+        {
+            if (last_status != 0)
+                add(RED, "[" + std::to_string(last_status) + "]");
+        }
+        else if (name == "duration")
+        {
+            if (last_duration >= DURATION_SHOWN_FROM)
+                add(CYAN, format_duration(last_duration));
+        }
+        else if (name == "jobs")
+        {
+            size_t count = jobs_table.size();
+            if (count > 0)
+                add(BLUE, "[" + std::to_string(count) + (count == 1 ? " job]" : " jobs]"));
+        }
+    }
+    return prompt + (prompt.empty() ? "" : " ") + GREEN + "$ " + RESET;
+}
+
+void print_prompt(bool refresh)
+{
+    shown_prompt = build_prompt(refresh);
+    std::cout << shown_prompt << std::flush;
+}
+
+void prompt_attach_line(LineView *view, const std::string *buffer, const int *cursor)
+{
+    active_view = view;
+    active_buffer = buffer;
+    active_cursor = cursor;
+}
+
+void prompt_command_finished(double seconds)
+{
+    last_duration = seconds;
+}
+
+int prompt_update_fd()
+{
+    return update_pipe[0];
+}
+
+void handle_prompt_update()
+{
+    char drain[64];
+    while (read(update_pipe[0], drain, sizeof(drain)) > 0)
+        ;
+    if (active_view == NULL)
+        return; // picked up by the next prompt
+    std::string prompt = build_prompt(false);
+    if (prompt == shown_prompt)
+        return;
+    shown_prompt = prompt;
+
+    // Back to column 0, the new prompt, then the whole line again
+    std::string out = "\r" + prompt + "\033[K";
+    *active_view = LineView();
+    render_line_diff(*active_view, *active_buffer, *active_cursor, out);
+    write_all(STDOUT_FILENO, out.data(), out.size());
+}
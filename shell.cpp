@@ -1,8 +1,32 @@
 // Library includes
 #include "SHELL.h"
+#include <thread>
+#include <memory>
 
 // prototypes
-bool handle_builtin(std::vector<char *> &args);
+bool handle_builtin(char **args);
+
+// variables
+bool interactive_mode = true;
+int last_status = 0;
+int builtin_status = 0;
+static const pid_t shell_pid = getpid(); // forked children must _exit()
+std::vector<std::string> positional_args;
+pid_t last_background_pid = 0;
+
+// Functions, each body kept as the tree it was parsed into, so a call (or
+// a loop iteration) runs it again without lexing or parsing anything
+static std::unordered_map<std::string, std::shared_ptr<const Node>> functions;
+
+// break / continue / return / Ctrl+C in progress: execute_list stops early
+// while one is pending, and the loop or function it targets clears it
+static int loop_depth = 0;
+static int function_depth = 0;
+static int break_loops = 0;    // loops still to leave
+static int continue_loops = 0; // loops to leave before the one that continues
+static bool returning = false;
+static bool interrupted = false; // a foreground command died of SIGINT
+static const int MAX_FUNCTION_DEPTH = 1000;
 
 std::string trim(const std::string &s)
 {
@@ -13,545 +37,1360 @@ std::string trim(const std::string &s)
     return s.substr(start, end - start + 1);
 }
 
-std::string find_longest_common_prefix(std::vector<std::string>& matches)
+static bool is_name_char(char c)
 {
-    if (matches.empty()) return "";
+    return std::isalnum((unsigned char)c) || c == '_';
+}
+
+// Exit status of the last command substitution, for "NAME=$(cmd)" alone
+static int substitution_status = -1;
 
-    std::string prefix = matches[0];
-    for (size_t i = 1; i < matches.size(); ++i)
+// Runs commands in a forked subshell and appends what they print to out,
+// minus trailing newlines. The output comes through a pipe into one
+// growing buffer, read in large chunks; the buffer's capacity at least
+// doubles whenever it fills, so megabytes of output cost O(n).
+bool command_substitution(const std::string &commands, std::string &out)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
     {
-        int len = std::min((int)prefix.length(), (int)matches[i].length());
-        int j = 0;
-        while (j < len && prefix[j] == matches[i][j])
-        {
-            j++;
-        }
-        prefix = prefix.substr(0, j);
-        if (prefix.empty()) return "";
+        perror("pipe");
+        return false;
     }
-    return prefix;
+    fcntl(pipefd[0], F_SETPIPE_SZ, 1024 * 1024); // fewer wakeups for big outputs; best effort
+
+    std::cout << std::flush;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Subshell: stays in the shell's group, like the rest of the command
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        interactive_mode = false;
+        dup2(pipefd[1], STDOUT_FILENO);
+
+        int status = run_command_line(commands);
+        std::cout << std::flush;
+        _exit(status); // no atexit handlers: they would write to the pipe
+    }
+    close(pipefd[1]);
+    if (pid < 0)
+    {
+        std::cerr << RED << "Error forking" << RESET << std::endl;
+        close(pipefd[0]);
+        return false;
+    }
+
+    static const size_t CHUNK = 64 * 1024;
+    size_t len = out.size();
+    while (true)
+    {
+        if (out.capacity() - len < CHUNK)
+            out.reserve(std::max(out.capacity() * 2, len + CHUNK));
+        out.resize(out.capacity());
+        ssize_t n = read(pipefd[0], &out[len], out.size() - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    out.resize(len);
+    close(pipefd[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    substitution_status = wait_status_to_exit_code(status);
+
+    while (!out.empty() && out.back() == '\n')
+        out.pop_back();
+    return true;
 }
 
-void get_completions(std::string word, std::vector<std::string>& matches)
+// A variable, or a positional parameter for "1", "2"...
+static const std::string *parameter_value(const std::string &name)
 {
-    DIR* dir = opendir("."); // Open current directory
-    if (dir == NULL) return;
+    if (!std::isdigit((unsigned char)name[0]))
+        return var_get(name);
+    size_t n = std::atol(name.c_str());
+    return n >= 1 && n <= positional_args.size() ? &positional_args[n - 1] : nullptr;
+}
 
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL)
+// Expands the parameter at text[i] ('$') onto out: $NAME, ${NAME},
+// ${NAME:-default}, ${NAME-default}, $(commands), $?, $$, $!, $1..., $#,
+// $@ and $*. Returns the index of its last character, or i when no parameter
+// starts there (a literal '$').
+static size_t expand_parameter(const std::string &text, size_t i, std::string &out)
+{
+    if (i + 1 >= text.size())
+        return i;
+    char next = text[i + 1];
+    if (next == '(')
     {
-        std::string name = entry->d_name;
-        // Check if the directory entry starts with the word we're completing
-        if (name.rfind(word, 0) == 0) 
+        size_t close = find_substitution_end(text, i + 1);
+        if (close == std::string::npos)
+            return i;
+        command_substitution(text.substr(i + 2, close - i - 2), out);
+        return close;
+    }
+    if (next == '?')
+    {
+        out += std::to_string(last_status);
+        return i + 1;
+    }
+    if (next == '#')
+    {
+        out += std::to_string(positional_args.size());
+        return i + 1;
+    }
+    if (next == '@' || next == '*')
+    {
+        for (size_t k = 0; k < positional_args.size(); k++)
+            out += (k > 0 ? " " : "") + positional_args[k];
+        return i + 1;
+    }
+    if (std::isdigit((unsigned char)next))
+    {
+        // $1 to $9; ${10} takes braces
+        if (const std::string *val = parameter_value(text.substr(i + 1, 1)))
+            out += *val;
+        return i + 1;
+    }
+    if (next == '$')
+    {
+        out += std::to_string(getpid());
+        return i + 1;
+    }
+    if (next == '!')
+    {
+        if (last_background_pid > 0)
+            out += std::to_string(last_background_pid);
+        return i + 1;
+    }
+
+    if (next == '{')
+    {
+        // The matching '}', skipping nested ${...} in the default
+        size_t close = i + 2;
+        int depth = 1;
+        for (; close < text.size(); close++)
+        {
+            if (text[close] == '\\')
+                close++;
+            else if (text[close] == '{')
+                depth++;
+            else if (text[close] == '}' && --depth == 0)
+                break;
+        }
+        size_t end = i + 2;
+        while (end < close && is_name_char(text[end]))
+            end++;
+        if (close >= text.size() || end == i + 2)
+            return i;
+
+        const std::string *val = parameter_value(text.substr(i + 2, end - i - 2));
+        if (end == close)
+        {
+            if (val)
+                out += *val;
+        }
+        else if (text[end] == '-' || text.compare(end, 2, ":-") == 0)
         {
-            // If it's a directory, add a trailing slash
-            if (entry->d_type == DT_DIR)
+            bool colon = text[end] == ':';
+            if (val == nullptr || (colon && val->empty()))
             {
-                name += "/";
+                size_t word = end + (colon ? 2 : 1);
+                expand_word_into(text.substr(word, close - word), out);
+            }
+            else
+            {
+                out += *val;
             }
-            matches.push_back(name);
         }
+        else
+        {
+            return i; // an operator we don't support: keep the text
+        }
+        return close;
+    }
+
+    if (!is_name_char(next))
+        return i;
+    size_t end = i + 1;
+    while (end < text.size() && is_name_char(text[end]))
+        end++;
+    if (const std::string *val = var_get(text.substr(i + 1, end - i - 1)))
+        out += *val;
+    return end - 1;
+}
+
+// Substitutes the `commands` whose opening backquote is at text[i]. Inside,
+// a backslash only escapes `, $ and itself. Returns the index of the
+// closing backquote, or i when there is none (a literal '`').
+static size_t expand_backquote(const std::string &text, size_t i, std::string &out)
+{
+    size_t close = find_backquote_end(text, i);
+    if (close == std::string::npos)
+        return i;
+    std::string commands;
+    for (size_t j = i + 1; j < close; j++)
+    {
+        if (text[j] == '\\' && strchr("`$\\", text[j + 1]) != NULL)
+            j++;
+        commands += text[j];
     }
-    closedir(dir);
+    command_substitution(commands, out);
+    return close;
 }
 
-void handle_tab_completion(std::string& cmd_buffer, int& cursor_pos)
+// Splits the unquoted substitution output at out[from..] into fields on
+// spaces, tabs and newlines. Fields are separated by '\0' like argv words
+// in the arena; a separator owed after trailing whitespace is left pending
+// until something follows it.
+static void split_fields(std::string &out, size_t from, size_t &field_start, bool &split_pending)
 {
-    // For now, we only support tab-completion at the end of the line
-    if (cursor_pos != (int)cmd_buffer.length())
+    std::string text = out.substr(from);
+    out.resize(from);
+    for (char c : text)
     {
-        return; // Too complex to insert in the middle, just return.
+        if (c == ' ' || c == '\t' || c == '\n')
+        {
+            split_pending = true;
+            continue;
+        }
+        if (split_pending && out.size() > field_start)
+        {
+            out += '\0';
+            field_start = out.size();
+        }
+        split_pending = false;
+        out += c;
     }
+}
 
-    // 1. Find the word we need to complete
-    size_t start_of_word = cmd_buffer.find_last_of(" ");
-    std::string word_to_complete;
+// Expands one raw word from the parser: removes quotes and backslashes and
+// replaces parameters and command substitutions (anywhere, bare or inside
+// double quotes) with their values. The result is appended to out. With
+// split, unquoted substitution output (and $@, $*) is split into several
+// '\0'-separated fields and "$@" gives one field per parameter. The
+// positions in out of unquoted *, ? and [ go into globs.
+// Returns false if an unquoted word expands to nothing and should be
+// dropped.
+bool expand_word_into(const std::string &raw, std::string &out, bool split, std::vector<size_t> *globs)
+{
+    const size_t base = out.size();
+    bool quoted = false;
+    bool in_double = false;
+    size_t field_start = base;
+    bool split_pending = false;
 
-    if (start_of_word == std::string::npos) // No space, it's the first word
+    for (size_t i = 0; i < raw.size(); i++)
     {
-        word_to_complete = cmd_buffer;
-        start_of_word = 0;
+        char c = raw[i];
+        char next = i + 1 < raw.size() ? raw[i + 1] : '\0';
+        bool substitution = c == '`' || (c == '$' && (next == '(' || next == '@' || next == '*'));
+        if (split_pending && !substitution)
+        {
+            if (out.size() > field_start)
+            {
+                out += '\0';
+                field_start = out.size();
+            }
+            split_pending = false;
+        }
+
+        if (c == '$' && next == '@' && split && in_double)
+        {
+            // "$@": one field per positional parameter, none if there are none
+            if (positional_args.empty() && raw == "\"$@\"")
+                return false;
+            for (size_t k = 0; k < positional_args.size(); k++)
+            {
+                if (k > 0)
+                {
+                    out += '\0';
+                    field_start = out.size();
+                }
+                out += positional_args[k];
+            }
+            i++;
+        }
+        else if (substitution && split && !in_double)
+        {
+            size_t from = out.size();
+            size_t last = c == '`' ? expand_backquote(raw, i, out) : expand_parameter(raw, i, out);
+            if (last == i)
+                out += c;
+            else
+                split_fields(out, from, field_start, split_pending);
+            i = last;
+        }
+        else if (c == '`')
+        {
+            size_t last = expand_backquote(raw, i, out);
+            if (last == i)
+                out += c;
+            i = last;
+        }
+        else if (c == '\'' && !in_double) // Handle single-quoted string
+        {
+            size_t close = raw.find('\'', i + 1);
+            out.append(raw, i + 1, close - i - 1);
+            i = close;
+            quoted = true;
+        }
+        else if (c == '\"')
+        {
+            in_double = !in_double;
+            quoted = true;
+        }
+        else if (c == '\\' && i + 1 < raw.size())
+        {
+            // Inside double quotes only \", \\, \$ and \` are escapes
+            if (!in_double || strchr("\"\\$`", raw[i + 1]) != NULL)
+                c = raw[++i];
+            out += c;
+        }
+        else if (c == '$')
+        {
+            size_t last = expand_parameter(raw, i, out);
+            if (last == i)
+                out += c;
+            i = last;
+        }
+        else
+        {
+            if (globs && !in_double && (c == '*' || c == '?' || c == '['))
+                globs->push_back(out.size());
+            out += c;
+        }
     }
-    else // It's a word after a space
+    return quoted || out.size() > base;
+}
+
+bool expand_word(const std::string &raw, std::string &out)
+{
+    out.clear();
+    return expand_word_into(raw, out);
+}
+
+// Expands a here-document body with an unquoted delimiter: parameters and
+// command substitutions are replaced anywhere in the text, and a backslash
+// only escapes $, ` and itself (or joins lines). Quotes are ordinary
+// characters.
+void expand_heredoc(const std::string &body, std::string &out)
+{
+    out.clear();
+    out.reserve(body.size());
+    for (size_t i = 0; i < body.size(); i++)
     {
-        word_to_complete = cmd_buffer.substr(start_of_word + 1);
-        start_of_word++; // Point index to the start of the word
+        char c = body[i];
+        if (c == '\\' && i + 1 < body.size() && strchr("$`\\\n", body[i + 1]) != NULL)
+        {
+            if (body[++i] != '\n')
+                out += body[i];
+        }
+        else if (c == '$' || c == '`')
+        {
+            size_t last = c == '$' ? expand_parameter(body, i, out) : expand_backquote(body, i, out);
+            if (last == i)
+                out += c;
+            i = last;
+        }
+        else
+        {
+            out += c;
+        }
     }
+}
 
-    // 2. Get all possible matches
-    std::vector<std::string> matches;
-    get_completions(word_to_complete, matches);
+void Argv::finish()
+{
+    size_t count = std::count(arena.begin(), arena.end(), '\0');
+    ptrs.clear();
+    ptrs.reserve(count + 1);
+    for (size_t start = 0; start < arena.size(); start = arena.find('\0', start) + 1)
+        ptrs.push_back(&arena[start]);
+    ptrs.push_back(NULL);
+}
 
-    if (matches.empty())
+// The glob pattern for text[from..end): the unquoted wildcards (at the
+// positions in globs, less base) stay, and every other wildcard character
+// is escaped so it matches itself. wild tells if any stayed.
+static std::string glob_pattern(const std::string &text, size_t from, size_t end, const std::vector<size_t> &globs,
+                                size_t base, bool &wild)
+{
+    std::string pattern;
+    wild = false;
+    auto g = std::lower_bound(globs.begin(), globs.end(), base + from);
+    for (size_t k = from; k < end; k++)
     {
-        return; // No matches, do nothing
+        if (g != globs.end() && *g - base == k)
+        {
+            wild = true;
+            ++g;
+        }
+        else if (strchr("*?[\\", text[k]) != NULL)
+        {
+            pattern += '\\';
+        }
+        pattern += text[k];
     }
+    return pattern;
+}
 
-    std::string part_to_add;
-    if (matches.size() == 1)
+// Replaces each field of the word at arena[start..] that has unquoted
+// wildcards (at the positions in globs) with the sorted paths it matches.
+// A field that matches nothing stays as it is.
+static void expand_globs(std::string &arena, size_t start, const std::vector<size_t> &globs)
+{
+    std::string word = arena.substr(start);
+    arena.resize(start);
+    for (size_t field = 0; field <= word.size();)
     {
-        // 3a. Only one match: complete the whole thing
-        std::string completion = matches[0];
-        part_to_add = completion.substr(word_to_complete.length());
+        size_t end = std::min(word.find('\0', field), word.size());
+        bool wild;
+        std::string pattern = glob_pattern(word, field, end, globs, start, wild);
 
-        // Add a space at the end if it's not a directory
-        if (completion.back() != '/')
+        std::vector<std::string> matches;
+        if (wild && glob_expand(pattern, matches))
         {
-            part_to_add += " ";
+            for (size_t m = 0; m < matches.size(); m++)
+            {
+                if (m > 0)
+                    arena += '\0';
+                arena += matches[m];
+            }
+        }
+        else
+        {
+            arena.append(word, field, end - field);
         }
+        if (end < word.size())
+            arena += '\0';
+        field = end + 1;
     }
-    else
+}
+
+Argv build_argv(const Node &cmd)
+{
+    Argv args;
+
+    // Words rarely grow when expanded, so this is usually the only arena allocation
+    size_t estimate = 0;
+    for (const std::string &raw : cmd.words)
+        estimate += raw.size() + 1;
+    args.arena.reserve(estimate);
+
+    std::vector<size_t> globs;
+    for (const std::string &raw : cmd.words)
     {
-        // 3b. Multiple matches: complete the longest common prefix
-        std::string prefix = find_longest_common_prefix(matches);
-        if (prefix.length() > word_to_complete.length())
+        size_t start = args.arena.size();
+        globs.clear();
+        if (!expand_word_into(raw, args.arena, true, &globs))
         {
-            part_to_add = prefix.substr(word_to_complete.length());
+            args.arena.resize(start);
+            continue;
         }
-        // (Future improvement: on a second tab press, list all options)
+        if (!globs.empty())
+            expand_globs(args.arena, start, globs);
+        args.arena += '\0';
     }
 
-    // 4. Update the buffer and print the completed part to the screen
-    if (!part_to_add.empty())
+    args.finish();
+    return args;
+}
+
+Assignments build_assignments(const Node &cmd)
+{
+    Assignments assigns;
+    for (const std::string &raw : cmd.assigns)
     {
-        cmd_buffer.insert(cursor_pos, part_to_add);
-        std::cout << part_to_add << std::flush;
-        cursor_pos += part_to_add.length();
+        size_t eq = raw.find('=');
+        std::string value;
+        expand_word(raw.substr(eq + 1), value);
+        assigns.push_back({raw.substr(0, eq), value});
     }
+    return assigns;
 }
 
-std::vector<std::string> split_commands(std::string input)
+void handle_fg(int jid)
 {
-    std::vector<std::string> commands;
-    size_t pos = 0;
+    // Look the job up by jid again after every wait: the jid is the handle
+    Job *job = jobs_table.find(jid);
+    if (job == nullptr)
+    {
+        std::cerr << RED << "fg: job not found: %" << jid << RESET << std::endl;
+        return;
+    }
+    pid_t pgid = job->pgid;
 
-    while ((pos = input.find("&&")) != std::string::npos)
+    // 1. Give terminal control to the job's process group
+    if (tcsetpgrp(STDIN_FILENO, pgid) < 0)
     {
-        std::string cmd = trim(input.substr(0, pos));
-        if (!cmd.empty())
-            commands.push_back(cmd);
-        input.erase(0, pos + 2); // remove up to and including &&
+        perror("tcsetpgrp");
+        return;
     }
 
-    input = trim(input);
-    if (!input.empty())
-        commands.push_back(input);
+    // 2. Send a "continue" signal (SIGCONT) in case it was stopped
+    if (kill(-pgid, SIGCONT) < 0)
+    {
+        perror("kill (SIGCONT)");
+        tcsetpgrp(STDIN_FILENO, getpid());
+        return;
+    }
+    job->status = RUNNING;
 
-    return commands;
-}
+    // 3. Wait for every member still alive (just like a normal foreground job)
+    bool stopped = false;
+    while (!stopped && job != nullptr && job->live > 0)
+    {
+        int status;
+        pid_t pid = waitpid(-pgid, &status, WUNTRACED);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break; // nothing left to wait for
+        }
+        if (trace_enabled)
+            trace_mark(WIFSTOPPED(status) ? "stopped" : "exit", pid, pgid, jid, job->command);
+        jobs_table.record_status(pid, status);
+        stopped = WIFSTOPPED(status);
+        job = jobs_table.find(jid);
+    }
 
-std::vector<std::string> split_pipes(const std::string &input)
-{
-    std::vector<std::string> commands;
-    size_t pos = 0;
-    std::string s = input;
+    // 4. Take back terminal control
+    tcsetpgrp(STDIN_FILENO, getpid());
 
-    while ((pos = s.find('|')) != std::string::npos)
+    if (job == nullptr)
+        return;
+    if (stopped)
     {
-        commands.push_back(trim(s.substr(0, pos)));
-        s.erase(0, pos + 1);
+        // Job was stopped again! Its status is already updated.
+        std::cout << std::endl
+                  << "[" << job->jid << "] Stopped\t" << job->command << std::endl;
+    }
+    else
+    {
+        // Job finished (normally or by signal), so remove it
+        last_status = job->exit_status;
+        jobs_table.remove(jid);
     }
-    s = trim(s);
-    if (!s.empty())
-        commands.push_back(s);
-
-    return commands;
 }
 
-// This new function splits a command string by '&'
-// It assumes '&&' has already been handled.
-std::vector<std::string> split_by_ampersand(const std::string &input)
+// "bg [options] %jid": options change a running job in place
+void handle_bg(int jid, const JobPlacement &placement)
 {
-    std::vector<std::string> commands;
-    size_t pos = 0;
-    std::string s = input;
+    Job *job = jobs_table.find(jid);
+    if (job == nullptr)
+    {
+        std::cerr << RED << "bg: job not found: %" << jid << RESET << std::endl;
+        return;
+    }
+
+    if (!placement.empty())
+    {
+        // Only the stages that are still running; reaped pids may be reused
+        std::vector<pid_t> live;
+        for (pid_t pid : job->pids)
+        {
+            if (jobs_table.find_by_pid(pid) == job)
+                live.push_back(pid);
+        }
+        if (!apply_placement(placement, live, job->pgid, "bg"))
+            builtin_status = 1;
+        merge_placement(job->placement, placement);
+        if (job->status == RUNNING)
+            return;
+    }
 
-    while ((pos = s.find('&')) != std::string::npos)
+    // 1. Check if the job is actually stopped
+    if (job->status == RUNNING)
     {
-        std::string cmd = trim(s.substr(0, pos));
-        if (!cmd.empty())
-            commands.push_back(cmd);
-        s.erase(0, pos + 1);
+        std::cerr << RED << "bg: job %" << jid << " is already running" << RESET << std::endl;
+        return;
     }
 
-    std::string remaining = trim(s);
-    if (!remaining.empty())
+    // 2. Send a "continue" signal (SIGCONT)
+    if (kill(-job->pgid, SIGCONT) < 0)
     {
-        commands.push_back(remaining);
+        perror("kill (SIGCONT)");
+        return;
     }
 
-    return commands;
+    // 3. Update the job's status
+    job->status = RUNNING;
+    std::cout << "[" << job->jid << "] " << job->command << " &" << std::endl;
+}
+
+// Converts a waitpid() status into a shell exit code (128 + signal if killed)
+int wait_status_to_exit_code(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 1;
 }
 
-std::vector<char *> tokenize_input(const std::string &input)
+// Runs a builtin, a function or a compound command in the shell process,
+// its redirections applied to the shell's own fds while it runs
+static int run_in_shell(const Node &cmd, Argv &args)
 {
-    std::vector<char *> tokens;
-    std::stringstream ss(input);
-    std::string token_str;
-    char c;
+    std::vector<Redirection> redirs;
+    if (!open_redirections(cmd.redirects, redirs))
+        return 1;
 
-    while (ss.get(c))
+    std::vector<std::pair<int, int>> saved; // target fd, saved copy
+    std::cout << std::flush;
+    for (const Redirection &redir : redirs)
     {
-        if (std::isspace(c))
-            continue;
+        saved.push_back({redir.target, fcntl(redir.target, F_DUPFD_CLOEXEC, 10)});
+        dup2(redir.fd, redir.target);
+    }
 
-        token_str.clear();
+    int status;
+    if (cmd.type != NODE_COMMAND)
+    {
+        status = execute_compound(cmd);
+    }
+    else if (is_builtin(args[0]))
+    {
+        handle_builtin(args.data());
+        status = builtin_status;
+    }
+    else
+    {
+        status = call_function(args.data());
+    }
 
-        if (c == '\"')
-        {
-            while (ss.get(c) && c != '\"')
-            {
-                token_str += c;
-            }
-        }
-        else if (c == '\'') // Handle single-quoted string
+    std::cout << std::flush;
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+    {
+        if (it->second != -1)
         {
-            while (ss.get(c) && c != '\'')
-            {
-                token_str += c;
-            }
+            dup2(it->second, it->first);
+            close(it->second);
         }
         else
         {
-            token_str += c;
-            while (ss.peek() != EOF && !std::isspace(ss.peek()))
-            {
-                ss.get(c);
-                token_str += c;
-            }
+            close(it->first);
         }
+    }
+    close_redirections(redirs);
+    return status;
+}
 
-        if (!token_str.empty() && token_str[0] == '$')
-        {
-            const char *val = getenv(token_str.c_str() + 1);
-            if (val)
-                token_str = val;
-            else
-                token_str = "";
-        }
+// A fork-free builtin as a pipeline stage runs on its own thread with the
+// stage's fds and closes them when done, so the next stage sees EOF. This
+// is what it leaves behind for execute_pipeline.
+struct ThreadResult
+{
+    int status = 0;
+    struct rusage usage; // the thread's own, for the time keyword
+    struct timespec end;
+};
 
-        if (!token_str.empty())
-        {
-            char *tok_cstr = new char[token_str.length() + 1];
-            std::strcpy(tok_cstr, token_str.c_str());
-            tokens.push_back(tok_cstr);
-        }
-    }
+static void run_builtin_thread(Argv args, BuiltinIO io, std::vector<int> owned, std::shared_ptr<ThreadResult> result)
+{
+    // A reader that exits early makes write() fail with EPIPE instead of
+    // killing the whole shell; the pending SIGPIPE goes away with the thread
+    sigset_t pipe_mask;
+    sigemptyset(&pipe_mask);
+    sigaddset(&pipe_mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_mask, NULL);
+
+    result->status = run_fork_free_builtin(args.data(), io);
+    for (int fd : owned)
+        close(fd);
+    getrusage(RUSAGE_THREAD, &result->usage);
+    clock_gettime(CLOCK_MONOTONIC, &result->end);
+}
 
-    tokens.push_back(NULL);
-    return tokens;
+// A command made only of assignments (and maybe redirections, which are
+// opened for their side effects, like creating the file). Its status is
+// that of the last command substitution in the values, if any.
+static int assign_variables(const Node &cmd)
+{
+    substitution_status = -1;
+    Assignments assigns = build_assignments(cmd);
+    std::vector<Redirection> redirs;
+    if (!open_redirections(cmd.redirects, redirs))
+        return 1;
+    close_redirections(redirs);
+    for (const auto &assign : assigns)
+        var_set(assign.first, assign.second);
+    return substitution_status >= 0 ? substitution_status : 0;
 }
 
-void handle_fg(int jid)
+bool is_function(const char *name)
 {
-    pid_t pid = -1;
-    std::string cmd_str = "";
-    Job *job_to_fg = nullptr;
+    return !functions.empty() && functions.count(name) > 0;
+}
 
-    // 1. Find the job in the list
-    for (auto &job : jobs_list)
+// Runs the function args[0] with args[1...] as $1...
+int call_function(char **args)
+{
+    if (function_depth >= MAX_FUNCTION_DEPTH)
     {
-        if (job.jid == jid)
-        {
-            pid = job.pid;
-            cmd_str = job.command;
-            job_to_fg = &job;
-            break;
-        }
+        std::cerr << RED << args[0] << ": maximum function nesting level exceeded" << RESET << std::endl;
+        return 1;
     }
+    std::shared_ptr<const Node> body = functions[args[0]]; // stays alive if redefined meanwhile
+    std::vector<std::string> call_args;
+    for (size_t i = 1; args[i] != NULL; i++)
+        call_args.push_back(args[i]);
+    positional_args.swap(call_args);
+
+    function_depth++;
+    int status = execute_compound(*body);
+    function_depth--;
+    returning = false;
+
+    positional_args.swap(call_args);
+    return status;
+}
 
-    if (pid == -1)
+// After a loop's condition or body: whether a pending break, continue,
+// return or Ctrl+C ends this loop. A continue that reaches its loop is
+// used up here and the loop goes on.
+static bool leave_loop()
+{
+    if (returning || interrupted)
+        return true;
+    if (break_loops > 0)
     {
-        std::cerr << RED << "fg: job not found: %" << jid << RESET << std::endl;
-        return;
+        break_loops--;
+        return true;
     }
+    if (continue_loops > 0)
+        return --continue_loops > 0;
+    return false;
+}
+
+static bool control_pending()
+{
+    return break_loops > 0 || continue_loops > 0 || returning || interrupted;
+}
 
-    // 2. Give terminal control to the job's process group
-    //    We use -pid because 'pid' is the process group ID (since we did setpgid(0,0))
-    if (tcsetpgrp(STDIN_FILENO, pid) < 0)
+// case: does the raw pattern word match subject? Patterns without
+// expansions are compiled once and kept.
+static bool case_matches(const std::string &raw, const std::string &subject)
+{
+    static std::unordered_map<std::string, GlobPattern> compiled;
+    bool constant = raw.find_first_of("$`") == std::string::npos;
+    auto it = constant ? compiled.find(raw) : compiled.end();
+    if (it == compiled.end())
     {
-        perror("tcsetpgrp");
-        return;
+        std::string text;
+        std::vector<size_t> globs;
+        bool wild;
+        expand_word_into(raw, text, false, &globs);
+        GlobPattern pattern;
+        pattern.compile(glob_pattern(text, 0, text.size(), globs, 0, wild));
+        pattern.dot_ok = true; // a leading '.' is nothing special here
+        if (!constant)
+            return pattern.match(subject.data(), subject.size());
+        it = compiled.emplace(raw, std::move(pattern)).first;
     }
+    return it->second.match(subject.data(), subject.size());
+}
 
-    // 3. Send a "continue" signal (SIGCONT) in case it was stopped
-    if (kill(-pid, SIGCONT) < 0)
+// Runs an if, while, until, for, case, { list; } or a function definition
+int execute_compound(const Node &cmd)
+{
+    int status = 0;
+    switch (cmd.type)
     {
-        perror("kill (SIGCONT)");
-        return;
+    case NODE_IF:
+    {
+        size_t i = 0;
+        for (; i + 1 < cmd.children.size(); i += 2)
+        {
+            int condition = execute_list(cmd.children[i]);
+            if (control_pending())
+                return condition;
+            if (condition == 0)
+                return execute_list(cmd.children[i + 1]);
+        }
+        return i < cmd.children.size() ? execute_list(cmd.children[i]) : 0;
     }
 
-    // 4. Wait for the job to finish (just like a normal foreground job)
-    int status;
-    waitpid(pid, &status, WUNTRACED); // We'll add WUNTRACED later for Ctrl+Z
-
-    // 5. Take back terminal control
-    tcsetpgrp(STDIN_FILENO, getpid());
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        loop_depth++;
+        while (true)
+        {
+            int condition = execute_list(cmd.children[0]);
+            if (control_pending())
+            {
+                if (leave_loop())
+                    break;
+                continue;
+            }
+            if ((condition == 0) != (cmd.type == NODE_WHILE))
+                break;
+            status = execute_list(cmd.children[1]);
+            if (leave_loop())
+                break;
+        }
+        loop_depth--;
+        return status;
 
-    // 6. Check how it exited (we'll expand this later)
-    if (WIFEXITED(status) || WIFSIGNALED(status))
+    case NODE_FOR:
     {
-        // Job finished (normally or by signal), so remove it
-        for (auto it = jobs_list.begin(); it != jobs_list.end(); ++it)
+        Argv items = build_argv(cmd); // split and globbed like arguments
+        loop_depth++;
+        for (size_t i = 0; i < items.size(); i++)
         {
-            if (it->jid == jid)
-            {
-                jobs_list.erase(it);
+            var_set(cmd.name, items[i]);
+            status = execute_list(cmd.children[0]);
+            if (leave_loop())
                 break;
-            }
         }
+        loop_depth--;
+        return status;
     }
-    else if (WIFSTOPPED(status))
+
+    case NODE_CASE:
     {
-        // Job was stopped again! Update its status.
-        if (job_to_fg != nullptr)
+        std::string subject;
+        expand_word(cmd.words[0], subject);
+        for (const Node &item : cmd.children)
         {
-            job_to_fg->status = STOPPED;
-            std::cout << std::endl
-                      << "[" << job_to_fg->jid << "] Stopped\t" << job_to_fg->command << std::endl;
+            for (const std::string &pattern : item.words)
+            {
+                if (case_matches(pattern, subject))
+                    return item.children.empty() ? 0 : execute_list(item);
+            }
         }
+        return 0;
+    }
+
+    case NODE_GROUP:
+        return execute_list(cmd.children[0]);
+
+    case NODE_FUNCTION:
+        functions[cmd.name] = std::make_shared<const Node>(cmd.children[0]);
+        return 0;
+
+    default:
+        return 0;
     }
 }
 
-void handle_bg(int jid)
+// The options of a "job" prefix, expanded like arguments
+static bool job_placement(const Node &pipeline, JobPlacement &placement)
 {
-    pid_t pid = -1;
-    Job *job_to_bg = nullptr; // Use a pointer
-
-    // 1. Find the job in the list
-    for (auto &job : jobs_list)
+    std::vector<std::string> words(pipeline.job_options.size());
+    std::vector<char *> ptrs;
+    for (size_t i = 0; i < words.size(); i++)
     {
-        if (job.jid == jid)
-        {
-            pid = job.pid;
-            job_to_bg = &job; // Store a pointer to the job
-            break;
-        }
+        expand_word(pipeline.job_options[i], words[i]);
+        ptrs.push_back(&words[i][0]);
     }
+    ptrs.push_back(NULL);
+    size_t i = 0;
+    return parse_placement(ptrs.data(), i, placement, "job");
+}
+
+int execute_pipeline(const Node &pipeline, bool is_background)
+{
+    const std::vector<Node> &stages = pipeline.children;
+    long long pipeline_start = trace_enabled ? trace_now() : 0;
 
-    if (pid == -1 || job_to_bg == nullptr)
+    // Expand every stage once, in the parent
+    std::vector<Argv> stage_args;
+    stage_args.reserve(stages.size());
+    for (const Node &stage : stages)
     {
-        std::cerr << RED << "bg: job not found: %" << jid << RESET << std::endl;
-        return;
+        stage_args.push_back(stage.type == NODE_COMMAND ? build_argv(stage) : Argv());
+        if (stage.type != NODE_COMMAND)
+            stage_args.back().finish(); // an empty argv: compound commands have no words to run
     }
 
-    // 2. Check if the job is actually stopped
-    if (job_to_bg->status == RUNNING)
+    // "time pipeline": stage usage is collected as the stages are reaped
+    bool timed = pipeline.time_format != TIME_NONE && !is_background;
+    struct timespec start_time;
+    std::vector<StageUsage> usage;
+    if (timed)
     {
-        std::cerr << RED << "bg: job %" << jid << " is already running" << RESET << std::endl;
-        return;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        usage.resize(stages.size());
+        for (size_t i = 0; i < stages.size(); ++i)
+            usage[i].command = stages[i].text;
     }
 
-    // 3. Send a "continue" signal (SIGCONT)
-    if (kill(-pid, SIGCONT) < 0)
+    // "job [options] pipeline": each stage applies it to itself before exec
+    JobPlacement placement;
+    if (!pipeline.job_options.empty() && !job_placement(pipeline, placement))
+        return 2;
+
+    // "NAME=value" on its own sets shell variables
+    if (stages.size() == 1 && !is_background && stage_args[0][0] == NULL && !stages[0].assigns.empty())
+        return assign_variables(stages[0]);
+
+    // A lone builtin, function or compound command runs in the shell
+    // itself (cd and export have to, and a loop must see what its body
+    // sets); NAME=value prefixes hold while it runs
+    const char *first = stage_args[0][0];
+    if (stages.size() == 1 && !is_background &&
+        (stages[0].type != NODE_COMMAND || (first != NULL && (is_builtin(first) || is_function(first)))))
     {
-        perror("kill (SIGCONT)");
-        return;
+        std::vector<SavedVar> saved;
+        if (!stages[0].assigns.empty())
+            var_apply_temporary(build_assignments(stages[0]), saved);
+
+        int code;
+        if (!timed)
+        {
+            code = run_in_shell(stages[0], stage_args[0]);
+        }
+        else
+        {
+            struct rusage before;
+            shell_usage(before);
+            code = usage[0].status = run_in_shell(stages[0], stage_args[0]);
+            shell_usage(usage[0].usage);
+            usage_since(usage[0].usage, before);
+            usage[0].real = seconds_since(start_time);
+            print_time_report(usage, usage[0].real, pipeline.text, pipeline.time_format);
+        }
+        if (!saved.empty())
+            var_restore(saved);
+        if (trace_enabled && pipeline_start > 0) // not for the "set -o trace" that just began
+            trace_span(stages[0].type == NODE_COMMAND ? "builtin" : "compound", pipeline_start, getpid(), getpgrp(), 0,
+                       pipeline.text);
+        return code;
     }
 
-    // 4. Update the job's status
-    job_to_bg->status = RUNNING;
-    std::cout << "[" << job_to_bg->jid << "] " << job_to_bg->command << " &" << std::endl;
-}
+    // A stage forked without exec (compound command, function, a builtin
+    // that needs a process) keeps every fd the shell had open, including
+    // the pipe a builtin thread writes to, and its reader would never see
+    // EOF. So only the stages from the last such one on get threads.
+    size_t first_thread_stage = 0;
+    for (size_t i = 0; i < stages.size(); ++i)
+    {
+        const char *name = stage_args[i][0];
+        if (stages[i].type != NODE_COMMAND || name == NULL || is_function(name) ||
+            (is_builtin(name) && !is_fork_free_builtin(name)))
+            first_thread_stage = i;
+    }
 
-void execute_pipes(const std::string &input, bool is_background)
-{
-    std::vector<std::string> pipe_cmds = split_pipes(input);
     int prev_fd = -1; // previous pipe read end
     std::vector<pid_t> pids;
-
-    for (size_t i = 0; i < pipe_cmds.size(); ++i)
+    std::vector<size_t> pid_stage;    // stage index of each pid
+    std::vector<long long> pid_start; // launch time of each pid, when tracing
+    std::vector<std::thread> threads; // stages run by fork-free builtins
+    std::vector<std::pair<size_t, std::shared_ptr<ThreadResult>>> thread_results; // stage index, result
+    pid_t last_pid = -1;              // last stage's, if it is a process
+    pid_t pgid = -1;
+    int exit_code = 0;
+
+    for (size_t i = 0; i < stages.size(); ++i)
     {
-        int pipefd[2];
-        if (i != pipe_cmds.size() - 1)
-            pipe(pipefd); // create pipe except for last command
-
-        pid_t pid = fork();
-        if (pid == 0) // child
+        int pipefd[2] = {-1, -1};
+        if (i != stages.size() - 1)
+            pipe2(pipefd, O_CLOEXEC); // create pipe except for last command
+
+        // All stages share the first stage's process group. Without job
+        // control (batch mode) foreground commands stay in the shell's group
+        // so a signal sent to the runner reaches them.
+        LaunchSpec spec;
+        if (interactive_mode || is_background)
+            spec.pgid = pgid == -1 ? 0 : pgid;
+        spec.foreground = !is_background && interactive_mode && pgid == -1;
+        spec.null_stdin = is_background && i == 0;                   // stdin for the *first* command
+        spec.null_stdout = is_background && i == stages.size() - 1; // stdout/stderr for the *last*
+        spec.stdin_fd = prev_fd;
+        spec.stdout_fd = pipefd[1];
+        if (stages[i].type != NODE_COMMAND)
+            spec.subshell = &stages[i];
+        if (!placement.empty())
+            spec.placement = &placement;
+
+        // echo, printf, test... need no process at all: run them on a thread
+        // bound to the pipe fds. Background jobs keep real processes for job
+        // control, and read only gets a thread when it reads from a pipe.
+        const char *name = stage_args[i][0];
+        std::vector<Redirection> redirs;
+        if (!is_background && i >= first_thread_stage && name != NULL && is_fork_free_builtin(name) &&
+            (strcmp(name, "read") != 0 || prev_fd != -1))
         {
-            setpgid(0, 0); // put child in its own process group
-            if (!is_background)
+            if (!open_redirections(stages[i].redirects, redirs))
             {
-                signal(SIGINT, SIG_DFL);  // Reset Ctrl+C to default
-                signal(SIGTSTP, SIG_DFL); // Reset Ctrl+Z to default
-                if (i == 0)
-                {
-                    // Give terminal control to the new foreground process group
-                    tcsetpgrp(STDIN_FILENO, getpid());
-                }
+                if (i == stages.size() - 1)
+                    exit_code = 1;
+                if (timed)
+                    usage[i].status = 1;
             }
-            if (is_background)
+            else
             {
-                // Redirect stdin for the *first* command
-                if (i == 0)
+                BuiltinIO io;
+                io.in_thread = true;
+                std::vector<int> owned; // the thread closes these
+                if (prev_fd != -1)
                 {
-                    int devNullIn = open("/dev/null", O_RDONLY);
-                    if (devNullIn != -1)
-                    {
-                        dup2(devNullIn, STDIN_FILENO);
-                        close(devNullIn);
-                    }
+                    io.in = prev_fd;
+                    owned.push_back(prev_fd);
+                    prev_fd = -1;
                 }
-
-                // Redirect stdout/stderr for the *last* command
-                if (i == pipe_cmds.size() - 1)
+                if (pipefd[1] != -1)
                 {
-                    int devNullOut = open("/dev/null", O_WRONLY);
-                    if (devNullOut != -1)
-                    {
-                        dup2(devNullOut, STDOUT_FILENO);
-                        dup2(devNullOut, STDERR_FILENO);
-                        close(devNullOut);
-                    }
+                    io.out = pipefd[1];
+                    owned.push_back(pipefd[1]);
+                    pipefd[1] = -1;
+                }
+                for (const Redirection &redir : redirs)
+                {
+                    if (redir.target == STDIN_FILENO)
+                        io.in = redir.fd;
+                    else if (redir.target == STDOUT_FILENO)
+                        io.out = redir.fd;
+                    else if (redir.target == STDERR_FILENO)
+                        io.err = redir.fd;
+                    owned.push_back(redir.fd);
                 }
-            }
 
-            if (prev_fd != -1)
+                std::shared_ptr<ThreadResult> result = std::make_shared<ThreadResult>();
+                thread_results.push_back({i, result});
+                threads.emplace_back(run_builtin_thread, std::move(stage_args[i]), io, std::move(owned), result);
+            }
+        }
+        else
+        {
+            // NAME=value prefixes go into this command's environment only
+            std::vector<std::string> env_storage;
+            std::vector<char *> env_ptrs;
+            if (!stages[i].assigns.empty())
+                spec.envp = var_envp_with(build_assignments(stages[i]), env_storage, env_ptrs);
+
+            int fail_status = 0;
+            long long launch_start = trace_enabled ? trace_now() : 0;
+            pid_t pid = launch_command(stage_args[i], stages[i].redirects, spec, fail_status);
+            if (pid > 0)
             {
-                dup2(prev_fd, STDIN_FILENO); // read from previous pipe
-                close(prev_fd);
+                pids.push_back(pid);
+                pid_stage.push_back(i);
+                pid_start.push_back(launch_start);
+                if (pgid == -1)
+                    pgid = pid;
+                if (i == stages.size() - 1)
+                    last_pid = pid;
             }
-
-            if (i != pipe_cmds.size() - 1)
+            else
             {
-                close(pipefd[0]);               // close read end
-                dup2(pipefd[1], STDOUT_FILENO); // write to pipe
-                close(pipefd[1]);
+                if (i == stages.size() - 1)
+                    exit_code = fail_status;
+                if (timed)
+                    usage[i].status = fail_status;
             }
+        }
 
-            handle_redirection(pipe_cmds[i]);
+        if (prev_fd != -1)
+            close(prev_fd); // close previous read end
 
-            std::vector<char *> args = tokenize_input(pipe_cmds[i]);
+        if (i != stages.size() - 1)
+        {
+            if (pipefd[1] != -1)
+                close(pipefd[1]); // close write end
+            prev_fd = pipefd[0];  // save read end for next command
+        }
+    }
 
-            if (args.empty() || args[0] == NULL)
+    // --- AFTER THE LOOP ---
+    // Parent waits for all children ONLY if it's a foreground job
+    int jid = 0;
+    pid_t group = interactive_mode || is_background ? pgid : getpgrp(); // for the trace
+    if (!is_background)
+    {
+        long long wait_start = trace_enabled ? trace_now() : 0;
+        int status = 0;
+        bool stopped = false;
+        std::vector<pid_t> alive; // stages still around if the job stopped
+        size_t waited = 0;
+        while (waited < pids.size())
+        {
+            pid_t p = pids[waited];
+            if (!timed)
+            {
+                waitpid(p, &status, WUNTRACED);
+                if (trace_enabled)
+                    trace_span(WIFSTOPPED(status) ? "stopped" : "run", pid_start[waited], p, group, 0, stages[pid_stage[waited]].text);
+            }
+            else
             {
-                // Clean up tokens before exiting
-                for (char *arg : args)
+                // Take the stages in the order they finish, so each one's
+                // wall time is its own and not that of a slower stage before it
+                struct rusage ru;
+                p = wait4(-1, &status, WUNTRACED, &ru);
+                if (p < 0 && errno == EINTR)
+                    continue;
+                if (p < 0)
+                    break;
+                size_t k = std::find(pids.begin(), pids.end(), p) - pids.begin();
+                if (k == pids.size())
                 {
-                    delete[] arg;
+                    record_child_status(p, status); // a background job
+                    continue;
                 }
-                exit(EXIT_SUCCESS);
+                if (trace_enabled)
+                    trace_span(WIFSTOPPED(status) ? "stopped" : "run", pid_start[k], p, group, 0, stages[pid_stage[k]].text);
+                StageUsage &stage = usage[pid_stage[k]];
+                stage.pid = p;
+                stage.usage = ru;
+                stage.real = seconds_since(start_time);
+                stage.status = wait_status_to_exit_code(status);
             }
-
-            if (!handle_builtin(args))
-                execvp(args[0], args.data());
-
-            perror("execvp");
-            for (char *arg : args)
+            waited++;
+            if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+                interrupted = true; // Ctrl+C ends the loops around this too
+            if (WIFSTOPPED(status))
             {
-                delete[] arg;
+                stopped = true;
+                alive.push_back(p);
             }
-            exit(EXIT_FAILURE);
+            // Like other shells, the pipeline's status is the last stage's
+            if (p == last_pid && exit_code == 0)
+                exit_code = wait_status_to_exit_code(status);
         }
-        else if (pid > 0)
-        {
-            pids.push_back(pid);
 
-            if (prev_fd != -1)
-                close(prev_fd); // close previous read end
+        if (trace_enabled && !pids.empty())
+            trace_span("wait", wait_start, getpid(), group, 0, pipeline.text);
 
-            if (i != pipe_cmds.size() - 1)
+        // A stopped job may have a thread blocked on its pipe: let it finish
+        // whenever the job does. Otherwise the threads are done or about to be.
+        for (std::thread &t : threads)
+        {
+            if (stopped)
+                t.detach();
+            else
+                t.join();
+        }
+        if (!stopped)
+        {
+            for (const auto &entry : thread_results)
             {
-                close(pipefd[1]);    // close write end
-                prev_fd = pipefd[0]; // save read end for next command
+                const ThreadResult &result = *entry.second;
+                if (entry.first == stages.size() - 1)
+                    exit_code = result.status;
+                if (timed)
+                {
+                    StageUsage &stage = usage[entry.first];
+                    stage.status = result.status;
+                    stage.usage = result.usage;
+                    stage.real = (result.end.tv_sec - start_time.tv_sec) + (result.end.tv_nsec - start_time.tv_nsec) / 1e9;
+                }
             }
-
-            // wait(NULL);
         }
-        else
+
+        // Take back terminal control
+        if (interactive_mode)
+            tcsetpgrp(STDIN_FILENO, getpid());
+
+        if (stopped)
         {
-            perror("fork");
+            // The job was stopped (Ctrl+Z)
+            std::cout << std::endl;
+            Job &new_job = jobs_table.add(pgid, alive, pipeline.text, STOPPED);
+            new_job.pid = pids.back();
+            new_job.exit_status = exit_code;
+            new_job.placement = placement;
+            jid = new_job.jid;
+            std::cout << "[" << new_job.jid << "] Stopped\t" << new_job.command << std::endl;
         }
-    }
-    // --- AFTER THE LOOP ---
-    // Parent waits for all children ONLY if it's a foreground job
-    if (!is_background)
-    {
-        int status;
-        for (pid_t p : pids)
+        else if (timed)
         {
-            waitpid(p, &status, 0);
-            // Note: 'success' bool for '&&' is not updated here,
-            // but this correctly waits for the pipeline.
+            print_time_report(usage, seconds_since(start_time), pipeline.text, pipeline.time_format);
         }
-
-        // Take back terminal control
-        tcsetpgrp(STDIN_FILENO, getpid());
     }
     else
     {
         // For a background job, just print the PID of the last command
         if (!pids.empty())
         {
-            Job new_job;
-            new_job.pid = pids.back(); // Use last PID as the representative
-            new_job.jid = get_next_jid();
-            new_job.command = input; // The whole pipe string
-            new_job.status = RUNNING;
-            jobs_list.push_back(new_job);
-
-            std::cout << BLUE << "[" << new_job.jid << "] " << new_job.pid << RESET << std::endl;
+            // The last PID is the representative; the whole pipe string is the name
+            Job &new_job = jobs_table.add(pgid, pids, pipeline.text, RUNNING);
+            jid = new_job.jid;
+            new_job.placement = placement;
+            last_background_pid = new_job.pid;
+
+            if (interactive_mode)
+                std::cout << BLUE << "[" << new_job.jid << "] " << new_job.pid << RESET << std::endl;
         }
     }
+
+    if (trace_enabled)
+        trace_span(is_background ? "start job" : "pipeline", pipeline_start, getpid(), group, jid, pipeline.text);
+    return exit_code;
 }
 
-void handle_redirection(std::string &cmd)
+// A foreground pipeline's status, inverted by a leading '!'
+static int run_pipeline_status(const Node &pipeline)
 {
-    int fd;
-    size_t pos;
+    int status = execute_pipeline(pipeline, false);
+    return pipeline.negate ? status == 0 : status;
+}
 
-    if ((pos = cmd.find(">>")) != std::string::npos)
+int execute_and_or(const Node &and_or)
+{
+    int status = run_pipeline_status(and_or.children[0]);
+    for (size_t i = 1; i < and_or.children.size() && !control_pending(); ++i)
     {
-        std::string filename = trim(cmd.substr(pos + 2));
-        cmd = trim(cmd.substr(0, pos));
-        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (fd < 0)
-        {
-            std::cerr << RED << "Error opening file for appending: " << filename << RESET << std::endl;
-            return;
-        }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
+        // '&&' runs the next pipeline only after success, '||' only after failure
+        bool is_or = and_or.or_ops[i - 1];
+        if ((status == 0) == is_or)
+            continue;
+        status = run_pipeline_status(and_or.children[i]);
     }
-    else if ((pos = cmd.find(">")) != std::string::npos)
+    return status;
+}
+
+// "a && b &": a single pipeline becomes a normal background job; a longer
+// and-or list runs in a forked subshell that is tracked as one job.
+static int run_background(const Node &and_or)
+{
+    if (and_or.children.size() == 1)
+        return execute_pipeline(and_or.children[0], true);
+
+    pid_t pid = fork();
+    if (pid == 0)
     {
-        std::string filename = trim(cmd.substr(pos + 1));
-        cmd = trim(cmd.substr(0, pos));
-        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd < 0)
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        interactive_mode = false; // no terminal handling inside the job
+
+        int devNullIn = open("/dev/null", O_RDONLY);
+        int devNullOut = open("/dev/null", O_WRONLY);
+        if (devNullIn != -1)
         {
-            std::cerr << RED << "Error opening file for writing: " << filename << RESET << std::endl;
-            return;
+            dup2(devNullIn, STDIN_FILENO);
+            close(devNullIn);
         }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
-    }
-    else if ((pos = cmd.find("<")) != std::string::npos)
-    {
-        std::string filename = trim(cmd.substr(pos + 1));
-        cmd = trim(cmd.substr(0, pos));
-        fd = open(filename.c_str(), O_RDONLY);
-        if (fd < 0)
+        if (devNullOut != -1)
         {
-            std::cerr << RED << "Error opening file for reading: " << filename << RESET << std::endl;
-            return;
+            dup2(devNullOut, STDOUT_FILENO);
+            dup2(devNullOut, STDERR_FILENO);
+            close(devNullOut);
         }
-        dup2(fd, STDIN_FILENO);
-        close(fd);
+        int status = execute_and_or(and_or);
+        std::cout << std::flush;
+        _exit(status);
+    }
+    if (pid < 0)
+    {
+        std::cerr << RED << "Error forking" << RESET << std::endl;
+        return 1;
     }
+
+    setpgid(pid, pid);
+    last_background_pid = pid;
+    Job &new_job = jobs_table.add(pid, {pid}, and_or.text, RUNNING);
+    if (interactive_mode)
+        std::cout << BLUE << "[" << new_job.jid << "] " << new_job.pid << RESET << std::endl;
+    return 0;
+}
+
+int execute_list(const Node &list)
+{
+    // A break or Ctrl+C left over from the previous command line is void
+    static int depth = 0;
+    if (depth == 0)
+    {
+        break_loops = continue_loops = 0;
+        returning = interrupted = false;
+    }
+
+    depth++;
+    int status = last_status;
+    for (const Node &item : list.children)
+    {
+        if (item.background)
+            status = run_background(item);
+        else
+            status = execute_and_or(item);
+        last_status = status;
+        if (control_pending())
+            break;
+    }
+    depth--;
+    return status;
+}
+
+// Parses and runs one line of input and returns the exit status of the
+// last command that ran.
+int run_command_line(const std::string &input)
+{
+    Node tree;
+    std::string error;
+    long long parse_start = trace_enabled ? trace_now() : 0;
+    ParseStatus parsed = parse_command_line(input, tree, error);
+    if (trace_enabled)
+        trace_span("parse", parse_start, getpid(), getpgrp(), 0, input);
+    if (parsed != PARSE_OK)
+    {
+        std::cerr << RED << error << RESET << std::endl;
+        last_status = 2;
+        return last_status;
+    }
+    return execute_list(tree);
+}
+
+static const char *builtins[] = {"exit", "cd", "help", "export", "unset", "jobs", "fg", "bg", "hash", "parallel", "set",
+                                 "echo", "printf", "test", "[", "true", ":", "false", "pwd", "read",
+                                 "break", "continue", "return", "shift", "wait", "ulimit"};
+
+bool is_builtin(const char *name)
+{
+    for (const char *b : builtins)
+    {
+        if (strcmp(name, b) == 0)
+            return true;
+    }
+    return false;
+}
+
+void get_builtin_names(std::vector<std::string> &names)
+{
+    for (const char *b : builtins)
+        names.push_back(b);
 }
 
-bool handle_builtin(std::vector<char *> &args)
+bool handle_builtin(char **args)
 {
-    if (args.empty() || args[0] == nullptr)
+    if (args == nullptr || args[0] == nullptr)
         return false;
 
     std::string cmd = args[0];
+    builtin_status = 0; // a builtin sets this when it fails
+
+    // echo, printf, test... write to the fds directly, not through std::cout
+    if (is_fork_free_builtin(args[0]))
+    {
+        std::cout << std::flush;
+        builtin_status = run_fork_free_builtin(args, BuiltinIO());
+        return true;
+    }
 
     if (cmd == "exit")
     {
-        std::cout << YELLOW << "Exiting shell..." << RESET << std::endl;
-        exit(0);
+        // "exit N" exits with N, plain "exit" with the last command's status
+        int code = args[1] != NULL ? std::atoi(args[1]) : last_status;
+        if (getpid() != shell_pid)
+        {
+            // exit in a pipeline stage, a subshell or $(...) ends only that
+            std::cout << std::flush;
+            _exit(code);
+        }
+        if (interactive_mode)
+            std::cout << YELLOW << "Exiting shell..." << RESET << std::endl;
+        exit(code);
     }
 
     else if (cmd == "cd")
@@ -561,13 +1400,13 @@ bool handle_builtin(std::vector<char *> &args)
         if (args[1] == NULL)
         {
             // No argument → go to home directory
-            const char *home = getenv("HOME");
+            const std::string *home = var_get("HOME");
             if (!home)
             {
                 std::cerr << RED << "cd: HOME not set" << RESET << std::endl;
                 return true;
             }
-            path = std::string(home);
+            path = *home;
             chdir(path.c_str());
             return true;
         }
@@ -587,7 +1426,7 @@ bool handle_builtin(std::vector<char *> &args)
             }
             else if (arg == "~")
             {
-                const char *home = getenv("HOME");
+                const std::string *home = var_get("HOME");
                 if (!home)
                 {
                     std::cerr << RED << "cd: HOME not set" << RESET << std::endl;
@@ -595,7 +1434,7 @@ bool handle_builtin(std::vector<char *> &args)
                 }
 
                 // Replace ~ with $HOME
-                path = std::string(home) + arg.substr(1);
+                path = *home + arg.substr(1);
             }
             else
             {
@@ -619,44 +1458,74 @@ bool handle_builtin(std::vector<char *> &args)
                   << "  cd <dir>     - Change directory\n"
                   << "  exit         - Exit the shell\n"
                   << "  help         - Show this help menu\n"
+                  << "  export [NAME[=value]...] - Export variables (NAME=value alone sets a local one)\n"
+                  << "  unset NAME... - Remove variables\n"
+                  << "  hash [-r] [name...] - Show, clear or add cached command paths\n"
+                  << "  parallel [-j N] [command] [::: args...] - Run jobs N at a time\n"
+                  << "  echo, printf, test/[, true, :, false, pwd, read - Built in, no fork\n"
+                  << "  time [-p|--json] pipeline - Report time and resources per stage\n"
+                  << "  set [-o|+o] trace - Start or stop writing an execution trace\n"
+                  << "  if/while/until/for/case, name() { ...; } - Control flow and functions\n"
+                  << "  break [N], continue [N], return [N], shift [N] - Leave loops, functions, shift $1...\n"
+                  << "  wait [-n] [-t secs] [%jid|pid...] - Wait for background jobs\n"
+                  << "  job [-C cpus] [-N nice] [-I io] [-H] [-cdflnstuv limit] pipeline - Place and limit a job\n"
+                  << "  bg [same options] %jid - Resume a job, or change a running one\n"
+                  << "  jobs [-l], ulimit [-H|-S] [-a] [-cdflnstuv] [limit] - Job settings, shell limits\n"
                   << "  command && command - Execute sequentially\n"
                   << RESET;
         return true;
     }
 
-    // export VAR=value
+    // export [NAME[=value]...]
     else if (cmd == "export")
     {
-        if (args.size() < 2)
+        if (args[1] == NULL)
         {
-            std::cerr << RED << "export: Invalid arguments" << RESET << std::endl;
+            for (const auto &var : var_exported())
+                std::cout << "export " << var.first << "=\"" << var.second << "\"" << std::endl;
             return true;
         }
 
-        std::string assignment(args[1]);
-        size_t eq_pos = assignment.find('=');
-
-        if (eq_pos == std::string::npos)
+        for (size_t i = 1; args[i] != NULL; i++)
         {
-            std::cerr << RED << "export: Invalid format, use VAR=value" << RESET << std::endl;
-            return true;
+            std::string assignment(args[i]);
+            size_t eq_pos = assignment.find('=');
+            std::string var = assignment.substr(0, eq_pos);
+            if (!is_valid_name(var))
+            {
+                std::cerr << RED << "export: `" << assignment << "': not a valid identifier" << RESET << std::endl;
+                builtin_status = 1;
+            }
+            else if (eq_pos != std::string::npos)
+                var_set(var, assignment.substr(eq_pos + 1), true);
+            else
+                var_export(var); // an unset name stays unset, as in dash
         }
+        return true;
+    }
 
-        std::string var = assignment.substr(0, eq_pos);
-        std::string value = assignment.substr(eq_pos + 1);
-
-        if (setenv(var.c_str(), value.c_str(), 1) != 0)
-            std::cerr << RED << "export: Failed to set variable" << RESET << std::endl;
-
+    // unset NAME...
+    else if (cmd == "unset")
+    {
+        for (size_t i = 1; args[i] != NULL; i++)
+            var_unset(args[i]);
         return true;
     }
+    // jobs [-l]: -l adds the pid and what job/bg options set
     else if (cmd == "jobs")
     {
-        for (const auto &job : jobs_list)
+        bool long_format = args[1] != NULL && strcmp(args[1], "-l") == 0;
+        reap_children(); // report finished jobs as gone
+        for (const Job *job : jobs_table.list())
         {
-            std::cout << "[" << job.jid << "] "
-                      << (job.status == RUNNING ? "Running " : "Stopped ")
-                      << "\t" << job.command << std::endl;
+            std::cout << "[" << job->jid << "] ";
+            if (long_format)
+                std::cout << job->pid << " ";
+            std::cout << (job->status == RUNNING ? "Running " : "Stopped ")
+                      << "\t" << job->command;
+            if (long_format && !job->placement.empty())
+                std::cout << "\t(" << describe_placement(job->placement) << ")";
+            std::cout << std::endl;
         }
         return true;
     }
@@ -682,13 +1551,20 @@ bool handle_builtin(std::vector<char *> &args)
     }
     else if (cmd == "bg")
     {
-        if (args[1] == NULL)
+        JobPlacement placement;
+        size_t i = 1;
+        if (!parse_placement(args, i, placement, "bg"))
+        {
+            builtin_status = 2;
+            return true;
+        }
+        if (args[i] == NULL)
         {
             std::cerr << RED << "bg: expected job ID (e.g., %1)" << RESET << std::endl;
             return true;
         }
 
-        std::string jid_str = args[1];
+        std::string jid_str = args[i];
         if (jid_str[0] == '%') // Remove the '%'
         {
             jid_str = jid_str.substr(1);
@@ -697,7 +1573,123 @@ bool handle_builtin(std::vector<char *> &args)
         int jid = std::stoi(jid_str);
 
         // This helper function (which we'll write next) does all the work
-        handle_bg(jid);
+        handle_bg(jid, placement);
+        return true;
+    }
+
+    else if (cmd == "parallel")
+    {
+        run_parallel(args);
+        return true;
+    }
+
+    // set -o trace / set +o trace: write an execution trace (see trace.cpp)
+    else if (cmd == "set")
+    {
+        if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL))
+        {
+            std::cout << "trace\t" << (trace_enabled ? "on" : "off") << std::endl;
+            return true;
+        }
+        if ((strcmp(args[1], "-o") != 0 && strcmp(args[1], "+o") != 0) || strcmp(args[2], "trace") != 0)
+        {
+            std::cerr << RED << "set: usage: set [-o | +o] trace" << RESET << std::endl;
+            builtin_status = 2;
+            return true;
+        }
+
+        if (args[1][0] == '+')
+        {
+            trace_stop();
+            return true;
+        }
+        const std::string *file = var_get("SIMPLE_SHELL_TRACE");
+        std::string path = file != nullptr && !file->empty() ? *file : "/tmp/simple_shell_trace." + std::to_string(getpid()) + ".json";
+        if (!trace_start(path))
+            builtin_status = 1;
+        else if (interactive_mode)
+            std::cout << "trace: writing to " << path << std::endl;
+        return true;
+    }
+
+    // break [N] / continue [N]: leave, or go on with, the Nth enclosing loop
+    else if (cmd == "break" || cmd == "continue")
+    {
+        int n = args[1] != NULL ? std::atoi(args[1]) : 1;
+        if (loop_depth == 0)
+        {
+            std::cerr << RED << cmd << ": only meaningful in a loop" << RESET << std::endl;
+            builtin_status = 1;
+        }
+        else if (n < 1)
+        {
+            std::cerr << RED << cmd << ": " << args[1] << ": loop count out of range" << RESET << std::endl;
+            builtin_status = 1;
+        }
+        else
+        {
+            (cmd == "break" ? break_loops : continue_loops) = std::min(n, loop_depth);
+        }
+        return true;
+    }
+
+    // return [N]: leave the function with N (or the last command's status)
+    else if (cmd == "return")
+    {
+        if (function_depth == 0)
+        {
+            std::cerr << RED << "return: can only be used in a function" << RESET << std::endl;
+            builtin_status = 1;
+            return true;
+        }
+        builtin_status = args[1] != NULL ? std::atoi(args[1]) & 255 : last_status;
+        returning = true;
+        return true;
+    }
+
+    // shift [N]: drop the first N positional parameters
+    else if (cmd == "shift")
+    {
+        long n = args[1] != NULL ? std::atol(args[1]) : 1;
+        if (n < 0 || (size_t)n > positional_args.size())
+        {
+            std::cerr << RED << "shift: " << n << ": shift count out of range" << RESET << std::endl;
+            builtin_status = 1;
+            return true;
+        }
+        positional_args.erase(positional_args.begin(), positional_args.begin() + n);
+        return true;
+    }
+
+    else if (cmd == "ulimit")
+    {
+        builtin_status = ulimit_builtin(args);
+        return true;
+    }
+
+    else if (cmd == "wait")
+    {
+        builtin_status = wait_builtin(args);
+        return true;
+    }
+
+    else if (cmd == "hash")
+    {
+        if (args[1] == NULL)
+        {
+            print_command_hash();
+            return true;
+        }
+
+        for (size_t i = 1; args[i] != NULL; i++)
+        {
+            std::string arg = args[i];
+            std::string path;
+            if (arg == "-r")
+                clear_command_hash();
+            else if (!is_builtin(args[i]) && !resolve_command(arg, path))
+                std::cerr << RED << "hash: " << arg << ": not found" << RESET << std::endl;
+        }
         return true;
     }
 
@@ -0,0 +1,157 @@
+// Library includes
+#include "SHELL.h"
+#include <cstdio>
+
+// The time keyword:
+//
+//   time [-p | --json] pipeline
+//
+// Each stage's resource usage comes from wait4() as it is reaped (or from
+// getrusage() for stages that ran inside the shell). The report goes to
+// stderr: one row per stage plus a total, POSIX "real/user/sys" with -p,
+// or a single JSON object with --json. In the total, maxrss is that of the
+// largest stage; every other figure is summed.
+
+double seconds_since(const struct timespec &start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double seconds(const struct timeval &tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void add_timeval(struct timeval &to, const struct timeval &tv, int sign)
+{
+    long usec = (to.tv_sec + sign * tv.tv_sec) * 1000000L + to.tv_usec + sign * tv.tv_usec;
+    to.tv_sec = usec / 1000000L;
+    to.tv_usec = usec % 1000000L;
+}
+
+// Adds (sign 1) or subtracts (sign -1) the counters; maxrss is a peak, so
+// it is only ever raised
+static void add_usage(struct rusage &to, const struct rusage &ru, int sign)
+{
+    add_timeval(to.ru_utime, ru.ru_utime, sign);
+    add_timeval(to.ru_stime, ru.ru_stime, sign);
+    to.ru_nvcsw += sign * ru.ru_nvcsw;
+    to.ru_nivcsw += sign * ru.ru_nivcsw;
+    to.ru_inblock += sign * ru.ru_inblock;
+    to.ru_oublock += sign * ru.ru_oublock;
+    if (sign > 0)
+        to.ru_maxrss = std::max(to.ru_maxrss, ru.ru_maxrss);
+}
+
+// What the shell has used so far on this thread, plus every child it reaped
+// (so "time parallel ..." counts the workers)
+void shell_usage(struct rusage &usage)
+{
+    struct rusage children;
+    getrusage(RUSAGE_THREAD, &usage);
+    getrusage(RUSAGE_CHILDREN, &children);
+    add_usage(usage, children, 1);
+}
+
+// Turns a shell_usage() taken after a command into what the command used
+void usage_since(struct rusage &usage, const struct rusage &before)
+{
+    add_usage(usage, before, -1);
+}
+
+static std::string format_rss(long kb)
+{
+    char buf[32];
+    if (kb >= 1024 * 1024)
+        snprintf(buf, sizeof(buf), "%.1fG", kb / (1024.0 * 1024.0));
+    else if (kb >= 1024)
+        snprintf(buf, sizeof(buf), "%.1fM", kb / 1024.0);
+    else
+        snprintf(buf, sizeof(buf), "%ldK", kb);
+    return buf;
+}
+
+static std::string format_row(const std::string &label, double real, const struct rusage &ru, const std::string &command)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%-6s %9.3fs %9.3fs %9.3fs %8s %6ld %6ld %6ld %6ld  ",
+             label.c_str(), real, seconds(ru.ru_utime), seconds(ru.ru_stime), format_rss(ru.ru_maxrss).c_str(),
+             ru.ru_nvcsw, ru.ru_nivcsw, ru.ru_inblock, ru.ru_oublock);
+    return buf + command + "\n";
+}
+
+std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+static std::string json_fields(double real, const struct rusage &ru)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+             "\"nvcsw\":%ld,\"nivcsw\":%ld,\"inblock\":%ld,\"oublock\":%ld",
+             real, seconds(ru.ru_utime), seconds(ru.ru_stime), ru.ru_maxrss,
+             ru.ru_nvcsw, ru.ru_nivcsw, ru.ru_inblock, ru.ru_oublock);
+    return buf;
+}
+
+void print_time_report(const std::vector<StageUsage> &stages, double real, const std::string &command, TimeFormat format)
+{
+    struct rusage total = {};
+    for (const StageUsage &stage : stages)
+        add_usage(total, stage.usage, 1);
+
+    std::string out;
+    if (format == TIME_POSIX)
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "real %.2f\nuser %.2f\nsys %.2f\n",
+                 real, seconds(total.ru_utime), seconds(total.ru_stime));
+        out = buf;
+    }
+    else if (format == TIME_JSON)
+    {
+        out = "{\"command\":" + json_string(command) + "," + json_fields(real, total) + ",\"stages\":[";
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            const StageUsage &stage = stages[i];
+            out += i == 0 ? "{" : ",{";
+            out += "\"command\":" + json_string(stage.command) + ",\"pid\":" + std::to_string(stage.pid) +
+                   ",\"status\":" + std::to_string(stage.status) + "," + json_fields(stage.real, stage.usage) + "}";
+        }
+        out += "]}\n";
+    }
+    else
+    {
+        out = "stage        real       user        sys   maxrss   vcsw  ivcsw  inblk  oublk  command\n";
+        if (stages.size() > 1)
+        {
+            for (size_t i = 0; i < stages.size(); ++i)
+                out += format_row(std::to_string(i + 1), stages[i].real, stages[i].usage, stages[i].command);
+        }
+        out += format_row("total", real, total, command);
+    }
+
+    std::cout << std::flush;
+    write_all(STDERR_FILENO, out.data(), out.size());
+}
@@ -0,0 +1,100 @@
+// Library includes
+#include "SHELL.h"
+
+// Execution tracing. With $SIMPLE_SHELL_TRACE set to a file name at
+// startup, or after "set -o trace", every phase of running a command is
+// written to that file as Chrome trace-event JSON (load it in Perfetto or
+// chrome://tracing): reading input, parsing, fork/posix_spawn, exec, the
+// wait and the whole pipeline. Shell work is on the shell's track and each
+// child gets a track of its own; events carry the pid, pgid and job id.
+//
+// Each event is one O_APPEND write, so a forked child can add its exec
+// event just before it execs, and a trace cut short by a crash still loads.
+// When tracing is off every call site costs one test of trace_enabled.
+
+bool trace_enabled = false;
+
+static int trace_fd = -1;
+static pid_t trace_pid = 0; // the shell that owns the trace
+
+long long trace_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static void trace_write(const std::string &event)
+{
+    // Every event after the header starts with a comma, so writers never
+    // need to know what came before
+    std::string line = ",\n" + event;
+    write_all(trace_fd, line.data(), line.size());
+}
+
+static std::string event_args(pid_t pid, pid_t pgid, int jid, const std::string &command)
+{
+    std::string args = "{\"pid\":" + std::to_string(pid) + ",\"pgid\":" + std::to_string(pgid);
+    if (jid > 0)
+        args += ",\"jid\":" + std::to_string(jid);
+    if (!command.empty())
+        args += ",\"command\":" + json_string(command);
+    return args + "}";
+}
+
+static std::string event_head(const char *name, const char *phase, pid_t tid)
+{
+    return "{\"name\":" + json_string(name) + ",\"ph\":\"" + phase + "\",\"pid\":" + std::to_string(trace_pid) +
+           ",\"tid\":" + std::to_string(tid);
+}
+
+bool trace_start(const std::string &path)
+{
+    trace_stop();
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << RED << "trace: cannot open " << path << ": " << strerror(errno) << RESET << std::endl;
+        return false;
+    }
+    trace_fd = fd;
+    trace_pid = getpid();
+    trace_enabled = true;
+
+    std::string header = "[" + event_head("process_name", "M", trace_pid) + ",\"args\":{\"name\":\"simple-shell\"}}";
+    write_all(trace_fd, header.data(), header.size());
+    trace_track_name(trace_pid, "shell");
+    return true;
+}
+
+void trace_stop()
+{
+    // Children inherit the fd; only the shell that opened it closes the array
+    if (!trace_enabled || getpid() != trace_pid)
+        return;
+    write_all(trace_fd, "\n]\n", 3);
+    close(trace_fd);
+    trace_fd = -1;
+    trace_enabled = false;
+}
+
+// A span from start until now
+void trace_span(const char *name, long long start, pid_t pid, pid_t pgid, int jid, const std::string &command)
+{
+    long long now = trace_now();
+    trace_write(event_head(name, "X", pid) + ",\"ts\":" + std::to_string(start) + ",\"dur\":" +
+                std::to_string(now - start) + ",\"args\":" + event_args(pid, pgid, jid, command) + "}");
+}
+
+// A single point in time
+void trace_mark(const char *name, pid_t pid, pid_t pgid, int jid, const std::string &command)
+{
+    trace_write(event_head(name, "i", pid) + ",\"s\":\"t\",\"ts\":" + std::to_string(trace_now()) +
+                ",\"args\":" + event_args(pid, pgid, jid, command) + "}");
+}
+
+// Labels pid's track in the viewer
+void trace_track_name(pid_t pid, const std::string &name)
+{
+    trace_write(event_head("thread_name", "M", pid) + ",\"args\":{\"name\":" + json_string(name) + "}}");
+}
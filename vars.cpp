@@ -0,0 +1,186 @@
+// Library includes
+#include "SHELL.h"
+
+extern char **environ;
+
+// Shell variables. Every variable, local or exported, lives in one hash
+// table, filled from the environment on first use. Commands get their
+// environment from a cached envp array of the exported variables, which
+// is rebuilt only after an exported variable changes, so an exec copies
+// or scans nothing. NAME=value prefixes on a command get a private envp
+// built from the cached one.
+
+static std::unordered_map<std::string, ShellVar> vars;
+static bool vars_loaded = false;
+
+static std::vector<std::string> env_strings; // "NAME=value" of every exported variable
+static std::vector<char *> env_ptrs;         // NULL-terminated, points into env_strings
+static bool env_stale = true;
+
+static void load_vars()
+{
+    if (vars_loaded)
+        return;
+    vars_loaded = true;
+    for (char **e = environ; *e != NULL; e++)
+    {
+        const char *eq = strchr(*e, '=');
+        if (eq != NULL)
+            vars[std::string(*e, eq - *e)] = ShellVar{eq + 1, true};
+    }
+}
+
+bool is_valid_name(const std::string &name)
+{
+    if (name.empty() || std::isdigit((unsigned char)name[0]))
+        return false;
+    for (char c : name)
+    {
+        if (!std::isalnum((unsigned char)c) && c != '_')
+            return false;
+    }
+    return true;
+}
+
+// The shell's own lookups follow PATH, so they are reset when it changes
+static void changed(const std::string &name, bool exported)
+{
+    if (exported)
+        env_stale = true;
+    if (name == "PATH")
+    {
+        clear_command_hash();
+        refresh_command_index();
+    }
+}
+
+const std::string *var_get(const std::string &name)
+{
+    load_vars();
+    auto it = vars.find(name);
+    return it != vars.end() ? &it->second.value : nullptr;
+}
+
+void var_set(const std::string &name, const std::string &value, bool exported)
+{
+    load_vars();
+    ShellVar &var = vars[name];
+    var.value = value;
+    var.exported = var.exported || exported;
+    changed(name, var.exported);
+}
+
+bool var_export(const std::string &name)
+{
+    load_vars();
+    auto it = vars.find(name);
+    if (it == vars.end())
+        return false;
+    if (!it->second.exported)
+    {
+        it->second.exported = true;
+        changed(name, true);
+    }
+    return true;
+}
+
+void var_unset(const std::string &name)
+{
+    load_vars();
+    auto it = vars.find(name);
+    if (it == vars.end())
+        return;
+    bool exported = it->second.exported;
+    vars.erase(it);
+    changed(name, exported);
+}
+
+// Exported variables, sorted by name (for "export" with no arguments)
+std::vector<std::pair<std::string, std::string>> var_exported()
+{
+    load_vars();
+    std::vector<std::pair<std::string, std::string>> list;
+    for (const auto &entry : vars)
+    {
+        if (entry.second.exported)
+            list.push_back({entry.first, entry.second.value});
+    }
+    std::sort(list.begin(), list.end());
+    return list;
+}
+
+char **var_envp()
+{
+    load_vars();
+    if (env_stale)
+    {
+        env_strings.clear();
+        for (const auto &entry : vars)
+        {
+            if (entry.second.exported)
+                env_strings.push_back(entry.first + "=" + entry.second.value);
+        }
+        env_ptrs.clear();
+        for (std::string &s : env_strings)
+            env_ptrs.push_back(&s[0]);
+        env_ptrs.push_back(NULL);
+        env_stale = false;
+    }
+    return env_ptrs.data();
+}
+
+// envp for one command with NAME=value prefixes; the strings live in storage
+char **var_envp_with(const Assignments &assigns, std::vector<std::string> &storage, std::vector<char *> &ptrs)
+{
+    char **base = var_envp();
+    storage.clear();
+    ptrs.clear();
+    for (const auto &assign : assigns)
+        storage.push_back(assign.first + "=" + assign.second);
+    for (std::string &s : storage)
+        ptrs.push_back(&s[0]);
+
+    // Inherited entries the prefixes don't override
+    for (char **e = base; *e != NULL; e++)
+    {
+        size_t len = strchr(*e, '=') - *e;
+        bool overridden = false;
+        for (const auto &assign : assigns)
+        {
+            if (assign.first.size() == len && assign.first.compare(0, len, *e, len) == 0)
+                overridden = true;
+        }
+        if (!overridden)
+            ptrs.push_back(*e);
+    }
+    ptrs.push_back(NULL);
+    return ptrs.data();
+}
+
+// NAME=value prefixes on a builtin hold (exported) only while it runs
+void var_apply_temporary(const Assignments &assigns, std::vector<SavedVar> &saved)
+{
+    load_vars();
+    for (const auto &assign : assigns)
+    {
+        auto it = vars.find(assign.first);
+        saved.push_back(SavedVar{assign.first, it != vars.end(), it != vars.end() ? it->second : ShellVar()});
+        var_set(assign.first, assign.second, true);
+    }
+}
+
+void var_restore(const std::vector<SavedVar> &saved)
+{
+    // Newest first, in case a name was assigned twice
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+    {
+        if (!it->was_set)
+        {
+            var_unset(it->name);
+            continue;
+        }
+        bool was_exported = vars.count(it->name) && vars[it->name].exported;
+        vars[it->name] = it->var;
+        changed(it->name, was_exported || it->var.exported);
+    }
+}
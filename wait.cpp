@@ -0,0 +1,262 @@
+// Library includes
+#include "SHELL.h"
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unordered_set>
+
+// The wait builtin. Every live process of the jobs being waited for gets a
+// pidfd, and all of them sit in one epoll set: a pidfd turns readable when
+// its process exits, so each wakeup hands back only the processes that
+// finished and reaps exactly those, however many jobs are running.
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+static volatile sig_atomic_t wait_interrupted = 0;
+
+static void on_wait_sigint(int)
+{
+    wait_interrupted = 1;
+}
+
+static int pidfd_open(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+// Parses "%jid" or a pid into the jid of a job in the table; a job that
+// already finished gives its remembered status instead
+static bool find_wait_target(const std::string &arg, int &jid, int &finished_code)
+{
+    jid = 0;
+    if (arg[0] == '%')
+    {
+        Job *job = jobs_table.find(std::atoi(arg.c_str() + 1));
+        if (job == nullptr && finished_jid_status(std::atoi(arg.c_str() + 1), finished_code))
+            return true;
+        if (job == nullptr)
+        {
+            std::cerr << RED << "wait: " << arg << ": no such job" << RESET << std::endl;
+            return false;
+        }
+        jid = job->jid;
+        return true;
+    }
+    char *end;
+    long pid = std::strtol(arg.c_str(), &end, 10);
+    if (*end != '\0' || pid <= 0)
+    {
+        std::cerr << RED << "wait: `" << arg << "': not a pid or valid job spec" << RESET << std::endl;
+        return false;
+    }
+    if (Job *job = jobs_table.find_by_pid(pid))
+    {
+        jid = job->jid;
+        return true;
+    }
+    if (finished_job_status(pid, finished_code))
+        return true;
+    std::cerr << RED << "wait: pid " << pid << " is not a child of this shell" << RESET << std::endl;
+    return false;
+}
+
+// wait [-n] [-t seconds] [%jid | pid]...
+// Waits for the given jobs (all of them by default) and returns the last
+// one's status; -n returns as soon as any one finishes, with its status.
+// -t gives up after the timeout with status 124, Ctrl+C with 130.
+int wait_builtin(char **args)
+{
+    bool any = false;
+    double timeout = -1;
+    size_t i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        if (strcmp(args[i], "-n") == 0)
+            any = true;
+        else if (strcmp(args[i], "-t") == 0 && args[i + 1] != NULL)
+            timeout = std::atof(args[++i]);
+        else
+        {
+            std::cerr << RED << "Usage: wait [-n] [-t seconds] [%jid | pid]..." << RESET << std::endl;
+            return 2;
+        }
+    }
+
+    // The jobs to wait for, in the order given; a job already gone counts
+    // as finished with its remembered status
+    std::vector<int> targets;
+    int status = 0;
+    bool had_error = false;
+    for (; args[i] != NULL; i++)
+    {
+        int jid, code = 0;
+        if (!find_wait_target(args[i], jid, code))
+        {
+            status = 127;
+            had_error = true;
+        }
+        else if (jid == 0)
+        {
+            status = code;
+            if (any)
+                return code;
+        }
+        else
+        {
+            targets.push_back(jid);
+        }
+    }
+    bool explicit_targets = !targets.empty() || had_error || status != 0;
+    if (!explicit_targets)
+    {
+        for (Job *job : jobs_table.list())
+            targets.push_back(job->jid);
+    }
+    if (targets.empty())
+        return any && !explicit_targets ? 127 : status;
+
+    // Ctrl+C interrupts the wait even though the shell ignores SIGINT
+    struct sigaction on_int = {}, saved_int;
+    on_int.sa_handler = on_wait_sigint;
+    sigemptyset(&on_int.sa_mask);
+    sigaction(SIGINT, &on_int, &saved_int);
+    wait_interrupted = 0;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    std::unordered_map<pid_t, int> watched; // pid -> its pidfd
+    std::unordered_map<int, int> done;      // jid -> exit code, for targets that finished
+    std::unordered_set<int> pending(targets.begin(), targets.end());
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool finished_any = false;
+    int any_status = 0;
+    std::vector<struct epoll_event> events(256);
+
+    // Reaps one process; a target job it completes is done
+    auto reap = [&](pid_t pid, int raw) {
+        Job *job = jobs_table.find_by_pid(pid);
+        if (job == nullptr)
+        {
+            record_child_status(pid, raw);
+            return;
+        }
+        int jid = job->jid;
+        int code = pid == job->pid ? wait_status_to_exit_code(raw) : job->exit_status;
+        record_child_status(pid, raw);
+        if (pending.count(jid) && jobs_table.find(jid) == nullptr)
+        {
+            done[jid] = code;
+            pending.erase(jid);
+            if (!finished_any)
+                any_status = code;
+            finished_any = true;
+        }
+    };
+
+    while (!pending.empty() && !(any && finished_any))
+    {
+        // Watch every live member of the pending jobs. A stopped job would
+        // never finish: it counts as done, with the status of a stop.
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            Job *job = jobs_table.find(*it);
+            if (job == nullptr || job->status == STOPPED)
+            {
+                int code = job == nullptr ? 0 : 128 + SIGTSTP;
+                done[*it] = code;
+                finished_any = true;
+                any_status = code;
+                it = pending.erase(it);
+                continue;
+            }
+            for (pid_t pid : job->pids)
+            {
+                if (watched.count(pid) || jobs_table.find_by_pid(pid) != job)
+                    continue; // already watched, or already reaped
+                int fd = pidfd_open(pid);
+                if (fd < 0)
+                    continue; // out of fds: picked up once others are closed
+                struct epoll_event ev = {};
+                ev.events = EPOLLIN;
+                ev.data.u64 = ((uint64_t)(uint32_t)pid << 32) | (uint32_t)fd;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+                watched[pid] = fd;
+            }
+            ++it;
+        }
+        if (pending.empty() || (any && finished_any))
+            break;
+
+        int wait_ms = -1;
+        if (timeout >= 0)
+        {
+            double left = timeout - seconds_since(start);
+            if (left <= 0)
+            {
+                status = 124;
+                break;
+            }
+            wait_ms = (int)(left * 1000) + 1;
+        }
+
+        int ready;
+        if (watched.empty())
+        {
+            // No pidfds (e.g. a kernel before 5.3): reap whatever has
+            // finished, then sleep on the SIGCHLD signalfd until the deadline
+            int raw;
+            pid_t pid;
+            bool reaped = false;
+            while ((pid = waitpid(-1, &raw, WNOHANG | WUNTRACED)) > 0)
+            {
+                reap(pid, raw);
+                reaped = true;
+            }
+            if (pid < 0 && errno == ECHILD)
+                break;
+            if (!reaped)
+                wait_child_event(wait_ms);
+            ready = 0;
+        }
+        else
+        {
+            ready = epoll_wait(epoll_fd, events.data(), events.size(), wait_ms);
+        }
+        if (wait_interrupted)
+        {
+            status = 130;
+            break;
+        }
+        if (ready < 0 && errno != EINTR)
+            break;
+
+        for (int k = 0; k < ready; k++)
+        {
+            pid_t pid = events[k].data.u64 >> 32;
+            int fd = (int)(uint32_t)events[k].data.u64;
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            close(fd);
+            watched.erase(pid);
+
+            int raw;
+            if (waitpid(pid, &raw, WNOHANG) > 0)
+                reap(pid, raw);
+        }
+    }
+
+    for (const auto &entry : watched)
+        close(entry.second);
+    close(epoll_fd);
+    sigaction(SIGINT, &saved_int, NULL);
+
+    if (status == 124 || status == 130)
+        return status;
+    if (any)
+        return finished_any ? any_status : 127;
+    if (!explicit_targets)
+        return 0;
+    // Like other shells: the status of the last job named
+    auto last = done.find(targets.back());
+    return last != done.end() ? last->second : status;
+}